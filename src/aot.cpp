@@ -0,0 +1,880 @@
+#include "emu/bus/bus.h"
+#include "emu/CPU/aot_module.h"
+#include "emu/CPU/opcodes.h"
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+// nestastic_aot: generates C++ for a ROM's PRG ROM code, one function per
+// basic block, for the host compiler to build into a module the core loads
+// (BusOptions::aot, AotModule).
+//
+// Blocks are found by walking the code reachable from the reset, NMI and IRQ
+// vectors. Every jump, branch and call target starts a block, as does the
+// return address of each call. Each block keeps to JitX64's rules: it ends
+// at a taken branch, a jump, a return, anything that can unmask an interrupt
+// or the end of the bank, and only its first instruction may touch PPU, APU,
+// I/O or mapper registers. An instruction that may do so starts a block of
+// its own, and one that always does ends it.
+//
+// Bank switching is only followed as far as it can be guessed statically. A
+// target in the same 8KB window stays in the same bank. A target in another
+// window is looked for in the bank that would be mapped there if banks were
+// mapped in order and in the bank mapped there at power on; from code reached
+// that way, also in every bank. Whatever the walk misses is interpreted.
+
+static void print_usage(const char *argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s --rom <path> --output <file.cpp>\n"
+        "\n"
+        "  --rom <path>        iNES ROM to compile\n"
+        "  --output <file>     C++ to write; build it as a shared library with the\n"
+        "                      repository root on the include path and pass it to\n"
+        "                      nestastic_headless --aot\n",
+        argv0);
+}
+
+namespace {
+
+// A PRG ROM bank, where it is mapped and an offset into it.
+struct Location {
+    uint32_t bank;
+    int window;
+    uint16_t offset;
+
+    uint16_t address() const { return static_cast<uint16_t>(0x8000 + window * 0x2000 + offset); }
+    bool operator<(const Location &other) const
+    {
+        return std::tie(bank, window, offset) < std::tie(other.bank, other.window, other.offset);
+    }
+};
+
+// Whether an instruction reads or writes its operand.
+bool reads(uint8_t opcode)
+{
+    int op = (opcode & OperationMask) >> OperationShift;
+    switch (instruction_group(opcode)) {
+    case InstructionGroup::Type1:
+        return op != STA;
+    case InstructionGroup::Type2:
+        return op != STX;
+    case InstructionGroup::Type0:
+        return op != STY;
+    default:
+        return false;
+    }
+}
+
+bool writes(uint8_t opcode)
+{
+    int op = (opcode & OperationMask) >> OperationShift;
+    switch (instruction_group(opcode)) {
+    case InstructionGroup::Type1:
+        return op == STA;
+    case InstructionGroup::Type2:
+        return op != LDX;
+    case InstructionGroup::Type0:
+        return op == STY;
+    default:
+        return false;
+    }
+}
+
+// Where an instruction's operand is: the operand itself, zero page, or
+// anywhere on the bus. Without a fixed address it is computed into ea by
+// `ea`; absolute indexed addresses are known to lie in [low, low + $FF].
+struct Operand {
+    enum Kind { None, Value, ZeroPage, Memory } kind = None;
+    bool fixed = true;
+    uint16_t address = 0;
+    std::string ea;
+    // The index register, if the addressing mode takes the page-cross cycle.
+    const char *penalty = nullptr;
+    bool ranged = false;
+    uint16_t low = 0;
+};
+
+Operand decode_operand(uint8_t opcode, uint16_t operand)
+{
+    InstructionGroup group = instruction_group(opcode);
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+    uint8_t zero_page = static_cast<uint8_t>(operand);
+    char ea[128];
+    Operand result;
+
+    auto indexed = [&](Operand::Kind kind, const char *index, const char *penalty) {
+        result.kind = kind;
+        result.fixed = false;
+        result.penalty = penalty;
+        if (kind == Operand::ZeroPage) {
+            std::snprintf(ea, sizeof(ea), "ea = (0x%02x + r.%s) & 0xff;", zero_page, index);
+        } else {
+            std::snprintf(ea, sizeof(ea), "ea = static_cast<uint16_t>(0x%04x + r.%s);", operand, index);
+            result.ranged = operand <= 0xff00;
+            result.low = operand;
+        }
+        result.ea = ea;
+    };
+
+    if (group == InstructionGroup::Implied) {
+        if (opcode == JMPI) {
+            result.kind = Operand::Memory;
+            result.address = operand;
+        }
+        return result;
+    }
+    if (group == InstructionGroup::Type1) {
+        bool store = op == STA;
+        switch (mode) {
+        case IndexedIndirectX:
+            std::snprintf(ea, sizeof(ea), "ea = r.ram[(0x%02x + r.x) & 0xff] | r.ram[(0x%02x + r.x + 1) & 0xff] << 8;",
+                          zero_page, zero_page);
+            result.kind = Operand::Memory;
+            result.fixed = false;
+            result.ea = ea;
+            return result;
+        case ZeroPage:
+            result.kind = Operand::ZeroPage;
+            result.address = zero_page;
+            return result;
+        case Immediate:
+            result.kind = Operand::Value;
+            result.address = zero_page;
+            return result;
+        case Absolute:
+            result.kind = Operand::Memory;
+            result.address = operand;
+            return result;
+        case IndirectY:
+            std::snprintf(ea, sizeof(ea), "ea = static_cast<uint16_t>((r.ram[0x%02x] | r.ram[0x%02x] << 8) + r.y);",
+                          zero_page, (zero_page + 1) & 0xff);
+            result.kind = Operand::Memory;
+            result.fixed = false;
+            result.ea = ea;
+            result.penalty = store ? nullptr : "y";
+            return result;
+        case IndexedX:
+            indexed(Operand::ZeroPage, "x", nullptr);
+            return result;
+        case AbsoluteY:
+            indexed(Operand::Memory, "y", store ? nullptr : "y");
+            return result;
+        case AbsoluteX:
+            indexed(Operand::Memory, "x", store ? nullptr : "x");
+            return result;
+        }
+    }
+
+    if (group == InstructionGroup::Type2 || group == InstructionGroup::Type0) {
+        // LDX/STX index with Y instead of X.
+        const char *index = group == InstructionGroup::Type2 && (op == LDX || op == STX) ? "y" : "x";
+        switch (mode) {
+        case Addr_Immediate:
+            result.kind = Operand::Value;
+            result.address = zero_page;
+            return result;
+        case Addr_ZeroPage:
+            result.kind = Operand::ZeroPage;
+            result.address = zero_page;
+            return result;
+        case Addr_Absolute:
+            result.kind = Operand::Memory;
+            result.address = operand;
+            return result;
+        case Addr_Indexed:
+            indexed(Operand::ZeroPage, index, nullptr);
+            return result;
+        case Addr_AbsoluteIndexed:
+            indexed(Operand::Memory, index, index);
+            return result;
+        }
+    }
+    return result;
+}
+
+enum class SideEffects { Never, Maybe, Always };
+
+// Whether an instruction touches PPU, APU, I/O or mapper registers.
+SideEffects side_effects(uint8_t opcode, const Operand &operand)
+{
+    if (operand.kind != Operand::Memory)
+        return SideEffects::Never;
+    bool read = reads(opcode) || opcode == JMPI;
+    bool write = writes(opcode);
+    if (operand.fixed) {
+        if (opcode == JMPI) {
+            uint16_t high = (operand.address & 0xff00) | ((operand.address + 1) & 0xff);
+            return is_io(operand.address) || is_io(high) ? SideEffects::Always : SideEffects::Never;
+        }
+        bool always = (read && is_io(operand.address)) || (write && is_io_write(operand.address));
+        return always ? SideEffects::Always : SideEffects::Never;
+    }
+    if (!operand.ranged)
+        return SideEffects::Maybe;
+    uint32_t low = operand.low, high = operand.low + 0xff;
+    bool io = low < 0x4020 && high >= 0x2000;
+    if (io || (write && high >= 0x8000))
+        return SideEffects::Maybe;
+    return SideEffects::Never;
+}
+
+struct Instruction {
+    uint8_t opcode;
+    uint16_t operand;
+    int length;
+    // False for BRK, unknown opcodes and instructions running past the bank,
+    // which are left to the interpreter.
+    bool compilable;
+};
+
+class Generator {
+public:
+    Generator(Bus &bus, const RomImage &rom);
+
+    // Finds every block reachable from the interrupt vectors.
+    void walk();
+    std::string generate(const char *rom_path);
+
+    size_t block_count() const { return blocks; }
+    size_t instruction_count() const { return instructions; }
+
+private:
+    static constexpr int MaxInstructions = 48;
+
+    Instruction decode(uint32_t bank, uint16_t offset) const;
+    bool is_start(uint32_t bank, int window, uint16_t offset) const
+    {
+        return starts.count(Location{bank, window, offset}) != 0;
+    }
+    void add(const Location &location, bool speculative);
+    // Adds a block at `address`, jumped to from `from`.
+    void add_target(const Location &from, uint16_t address, bool speculative);
+    void walk(const Location &start);
+
+    void line(const char *format, ...);
+    void block(const Location &start);
+    bool instruction(const Location &at, const Instruction &instruction, bool first);
+    std::string load(const Operand &operand, bool first);
+    void store(const Operand &operand, const char *value, bool first);
+    void add_cycles(int cycles, const Operand *operand = nullptr);
+    void leave(uint16_t pc);
+
+    const uint8_t *prg;
+    size_t prg_size;
+    uint32_t bank_count;
+    // The bank mapped at each window at power on, or -1.
+    int power_on[4];
+    uint16_t vectors[3];
+
+    // Block starts, and whether each was only reached by guessing at banks.
+    std::map<Location, bool> starts;
+    std::deque<Location> work;
+
+    std::string code;
+    // Set when the instruction being generated may have set io.
+    bool io = false;
+    size_t blocks = 0;
+    size_t instructions = 0;
+};
+
+Generator::Generator(Bus &bus, const RomImage &rom) : prg(rom.prg()), prg_size(rom.prg_size()),
+                                                         bank_count(static_cast<uint32_t>(rom.prg_size() / 0x2000))
+{
+    // As CPU::map_prg_windows() maps them.
+    const Cartridge &cart = *bus.cart;
+    for (int window = 0; window < 4; ++window) {
+        power_on[window] = -1;
+        uint16_t addr = 0x8000 + window * 0x2000;
+        uint32_t first = UINT32_MAX, last = UINT32_MAX;
+        uint8_t data = 0;
+        if (!cart.mapper->prgRead(addr, first, data) || !cart.mapper->prgRead(addr + 0x1fff, last, data))
+            continue;
+        if ((first & 0x1fff) || last != first + 0x1fff || last >= cart.prg_size)
+            continue;
+        power_on[window] = static_cast<int>(first / 0x2000);
+    }
+
+    vectors[0] = bus.cpu.read_address(0xfffa);
+    vectors[1] = bus.cpu.read_address(0xfffc);
+    vectors[2] = bus.cpu.read_address(0xfffe);
+}
+
+Instruction Generator::decode(uint32_t bank, uint16_t offset) const
+{
+    const uint8_t *code = prg + bank * 0x2000;
+    Instruction result{code[offset], 0, instruction_length(code[offset]), false};
+    if (offset + result.length > 0x2000)
+        return result;
+    if (result.length > 1)
+        result.operand = code[offset + 1] | (result.length > 2 ? code[offset + 2] << 8 : 0);
+    result.compilable = instruction_group(result.opcode) != InstructionGroup::Unknown && result.opcode != BRK;
+    return result;
+}
+
+void Generator::add(const Location &location, bool speculative)
+{
+    auto start = starts.find(location);
+    if (start == starts.end()) {
+        starts.emplace(location, speculative);
+        work.push_back(location);
+    } else if (start->second && !speculative) {
+        start->second = false;
+        work.push_back(location);
+    }
+}
+
+void Generator::add_target(const Location &from, uint16_t address, bool speculative)
+{
+    // Code in RAM or PRG RAM is never compiled.
+    if (address < 0x8000)
+        return;
+    int window = (address - 0x8000) >> 13;
+    uint16_t offset = address & 0x1fff;
+    if (window == from.window) {
+        add(Location{from.bank, window, offset}, speculative);
+        return;
+    }
+
+    int64_t in_order = static_cast<int64_t>(from.bank) + window - from.window;
+    if (from.window >= 0 && in_order >= 0 && in_order < bank_count)
+        add(Location{static_cast<uint32_t>(in_order), window, offset}, speculative);
+    if (power_on[window] >= 0)
+        add(Location{static_cast<uint32_t>(power_on[window]), window, offset}, speculative);
+    if (!speculative) {
+        for (uint32_t bank = 0; bank < bank_count; ++bank)
+            add(Location{bank, window, offset}, true);
+    }
+}
+
+void Generator::walk()
+{
+    // The vectors themselves say nothing about which bank they point into.
+    for (uint16_t vector : vectors)
+        add_target(Location{0, -1, 0}, vector, false);
+
+    while (!work.empty()) {
+        Location start = work.front();
+        work.pop_front();
+        walk(start);
+    }
+}
+
+// Follows a block to its end, adding every block it can continue at. It stops
+// early at the start of another block, which is walked on its own.
+void Generator::walk(const Location &start)
+{
+    bool speculative = starts.at(start);
+    Location at = start;
+    for (int count = 0;; ++count) {
+        uint16_t pc = at.address();
+        if (count > 0 && is_start(at.bank, at.window, at.offset)) {
+            add(at, speculative);
+            return;
+        }
+        if (count == MaxInstructions) {
+            add(at, speculative);
+            return;
+        }
+        if (at.offset >= 0x2000) {
+            add_target(start, pc, speculative);
+            return;
+        }
+
+        Instruction instruction = decode(at.bank, at.offset);
+        if (!instruction.compilable)
+            return;
+        Operand operand = decode_operand(instruction.opcode, instruction.operand);
+        SideEffects effects = side_effects(instruction.opcode, operand);
+        if (effects != SideEffects::Never && count > 0) {
+            add(at, speculative);
+            return;
+        }
+
+        uint16_t next = static_cast<uint16_t>(pc + instruction.length);
+        if (effects == SideEffects::Always)
+            add_target(at, next, speculative);
+
+        switch (instruction_group(instruction.opcode)) {
+        case InstructionGroup::Branch:
+            add_target(at, static_cast<uint16_t>(next + static_cast<int8_t>(instruction.operand)), speculative);
+            break;
+        case InstructionGroup::Implied:
+            switch (instruction.opcode) {
+            case JSR:
+                add_target(at, instruction.operand, speculative);
+                add_target(at, next, speculative);
+                return;
+            case JMP:
+                add_target(at, instruction.operand, speculative);
+                return;
+            case JMPI:
+            case RTS:
+            case RTI:
+                return;
+            case PLP:
+            case CLI:
+                add_target(at, next, speculative);
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+        at.offset += instruction.length;
+    }
+}
+
+void Generator::line(const char *format, ...)
+{
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    code += "    ";
+    code += buffer;
+    code += '\n';
+}
+
+void Generator::leave(uint16_t pc)
+{
+    line("return aot::leave(s, r, 0x%04x);", pc);
+}
+
+void Generator::add_cycles(int cycles, const Operand *operand)
+{
+    if (operand && operand->penalty)
+        line("r.cycles += %d + ((ea & 0xff) < r.%s);", cycles, operand->penalty);
+    else
+        line("r.cycles += %d;", cycles);
+}
+
+// An expression for the operand's value. Internal RAM is read inline and
+// cartridge memory through the bus. Only the first instruction may read PPU,
+// APU and I/O registers, or addresses that may turn out to be one of them.
+std::string Generator::load(const Operand &operand, bool first)
+{
+    char buffer[64];
+    if (operand.kind == Operand::Value) {
+        std::snprintf(buffer, sizeof(buffer), "0x%02x", operand.address);
+    } else if (operand.kind == Operand::ZeroPage) {
+        if (operand.fixed)
+            std::snprintf(buffer, sizeof(buffer), "r.ram[0x%02x]", operand.address);
+        else
+            std::snprintf(buffer, sizeof(buffer), "r.ram[ea]");
+    } else if (operand.fixed) {
+        if (operand.address < 0x2000) {
+            std::snprintf(buffer, sizeof(buffer), "r.ram[0x%03x]", operand.address & 0x7ff);
+        } else if (is_io(operand.address)) {
+            std::snprintf(buffer, sizeof(buffer), "aot::read_io(s, 0x%04x)", operand.address);
+            io = true;
+        } else {
+            std::snprintf(buffer, sizeof(buffer), "aot::read_cart(s, 0x%04x)", operand.address);
+        }
+    } else if (!first) {
+        // side_effects() has ruled out PPU, APU and I/O registers.
+        std::snprintf(buffer, sizeof(buffer), operand.low < 0x2000 ? "r.ram[ea & 0x7ff]" : "aot::read_cart(s, ea)");
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "aot::read(s, r, ea)");
+        io = true;
+    }
+    return buffer;
+}
+
+// Writes `value` to the operand, like load(). Mapper registers at $8000-$FFFF
+// are treated like the PPU, APU and I/O registers; PRG RAM below them is not.
+void Generator::store(const Operand &operand, const char *value, bool first)
+{
+    if (operand.kind == Operand::ZeroPage) {
+        if (operand.fixed)
+            line("r.ram[0x%02x] = %s;", operand.address, value);
+        else
+            line("r.ram[ea] = %s;", value);
+    } else if (operand.fixed) {
+        if (operand.address < 0x2000) {
+            line("r.ram[0x%03x] = %s;", operand.address & 0x7ff, value);
+        } else {
+            line("aot::%s(s, 0x%04x, %s);", is_io_write(operand.address) ? "write_io" : "write_cart",
+                 operand.address, value);
+            io = true;
+        }
+    } else if (!first) {
+        if (operand.low < 0x2000) {
+            line("r.ram[ea & 0x7ff] = %s;", value);
+        } else {
+            line("aot::write_cart(s, ea, %s);", value);
+            io = true;
+        }
+    } else {
+        line("aot::write(s, r, ea, %s);", value);
+        io = true;
+    }
+}
+
+void Generator::block(const Location &start)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "b%u_%04x", start.bank, start.address());
+    code += "void ";
+    code += name;
+    code += "(BlockState *s)\n{\n";
+    line("aot::Regs r = aot::enter(s);");
+    line("uint16_t ea = 0;");
+    line("(void)ea;");
+
+    Location at = start;
+    for (int count = 0;; ++count) {
+        uint16_t pc = at.address();
+        if (count > 0 && (count == MaxInstructions || at.offset >= 0x2000 || is_start(at.bank, at.window, at.offset))) {
+            leave(pc);
+            break;
+        }
+        Instruction decoded = decode(at.bank, at.offset);
+        if (count > 0 && (!decoded.compilable ||
+                          side_effects(decoded.opcode, decode_operand(decoded.opcode, decoded.operand)) != SideEffects::Never)) {
+            leave(pc);
+            break;
+        }
+
+        code += "\n";
+        if (decoded.length == 1)
+            line("// $%04X: %02X", pc, decoded.opcode);
+        else if (decoded.length == 2)
+            line("// $%04X: %02X %02X", pc, decoded.opcode, decoded.operand);
+        else
+            line("// $%04X: %02X %02X %02X", pc, decoded.opcode, decoded.operand & 0xff, decoded.operand >> 8);
+        if (count > 0)
+            line("if (r.cycles > r.budget) return aot::leave(s, r, 0x%04x);", pc);
+        ++instructions;
+        at.offset += decoded.length;
+        if (!instruction(at, decoded, count == 0))
+            break;
+    }
+    code += "}\n\n";
+}
+
+// Generates one instruction, `at` being the next one. Returns false if it
+// ends the block.
+bool Generator::instruction(const Location &at, const Instruction &decoded, bool first)
+{
+    uint8_t opcode = decoded.opcode;
+    uint16_t operand = decoded.operand;
+    InstructionGroup group = instruction_group(opcode);
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+    int cycles = OperationCycles[opcode];
+    uint16_t next = at.address();
+    io = false;
+
+    if (group == InstructionGroup::Implied) {
+        switch (static_cast<OperationImplied>(opcode)) {
+        case NOP: break;
+        case JSR:
+            line("aot::push(r, 0x%02x);", ((next - 1) >> 8) & 0xff);
+            line("aot::push(r, 0x%02x);", (next - 1) & 0xff);
+            add_cycles(cycles);
+            leave(operand);
+            return false;
+        case RTS:
+            line("{");
+            line("    uint8_t low = aot::pop(r);");
+            line("    uint8_t high = aot::pop(r);");
+            line("    r.cycles += %d;", cycles);
+            line("    return aot::leave(s, r, static_cast<uint16_t>((low | high << 8) + 1));");
+            line("}");
+            return false;
+        case RTI:
+            line("aot::set_status(r, aot::pop(r));");
+            line("{");
+            line("    uint8_t low = aot::pop(r);");
+            line("    uint8_t high = aot::pop(r);");
+            line("    r.cycles += %d;", cycles);
+            line("    return aot::leave(s, r, static_cast<uint16_t>(low | high << 8));");
+            line("}");
+            return false;
+        case JMP:
+            add_cycles(cycles);
+            leave(operand);
+            return false;
+        case JMPI: {
+            // The high byte comes from the start of the same page if the
+            // pointer is at the end of one.
+            Operand high = decode_operand(opcode, operand);
+            high.address = (operand & 0xff00) | ((operand + 1) & 0xff);
+            line("{");
+            line("    uint8_t low = %s;", load(decode_operand(opcode, operand), first).c_str());
+            line("    uint8_t high = %s;", load(high, first).c_str());
+            line("    r.cycles += %d;", cycles);
+            line("    return aot::leave(s, r, static_cast<uint16_t>(low | high << 8));");
+            line("}");
+            return false;
+        }
+        case PHP: line("aot::push(r, aot::status(r));"); break;
+        case PLP:
+            // May unmask a pending IRQ, which the interpreter takes next.
+            line("aot::set_status(r, aot::pop(r));");
+            add_cycles(cycles);
+            leave(next);
+            return false;
+        case PHA: line("aot::push(r, r.a);"); break;
+        case PLA: line("r.a = aot::pop(r);"); line("aot::set_zn(r, r.a);"); break;
+        case DEY: line("--r.y;"); line("aot::set_zn(r, r.y);"); break;
+        case DEX: line("--r.x;"); line("aot::set_zn(r, r.x);"); break;
+        case INY: line("++r.y;"); line("aot::set_zn(r, r.y);"); break;
+        case INX: line("++r.x;"); line("aot::set_zn(r, r.x);"); break;
+        case TAY: line("r.y = r.a;"); line("aot::set_zn(r, r.y);"); break;
+        case TYA: line("r.a = r.y;"); line("aot::set_zn(r, r.a);"); break;
+        case TXA: line("r.a = r.x;"); line("aot::set_zn(r, r.a);"); break;
+        case TAX: line("r.x = r.a;"); line("aot::set_zn(r, r.x);"); break;
+        case TSX: line("r.x = r.sp;"); line("aot::set_zn(r, r.x);"); break;
+        case TXS: line("r.sp = r.x;"); break;
+        case CLC: line("r.carry = 0;"); break;
+        case SEC: line("r.carry = 1;"); break;
+        case CLV: line("r.overflow = 0;"); break;
+        case SEI: line("r.flags |= 0x04;"); break;
+        case CLD: line("r.flags &= 0xf7;"); break;
+        case SED: line("r.flags |= 0x08;"); break;
+        case CLI:
+            line("r.flags &= 0xfb;");
+            add_cycles(cycles);
+            leave(next);
+            return false;
+        case BRK:
+            break;
+        }
+        add_cycles(cycles);
+        return true;
+    }
+
+    if (group == InstructionGroup::Branch) {
+        const char *flag = "";
+        switch (opcode >> BranchOnFlagShift) {
+        case Negative: flag = "(r.negative_result & 0x80) != 0"; break;
+        case Overflow: flag = "r.overflow != 0"; break;
+        case Carry: flag = "r.carry != 0"; break;
+        case Zero: flag = "r.zero_result == 0"; break;
+        }
+        bool on_set = opcode & BranchConditionMask;
+
+        // Taken branches leave the block; the fall-through carries on.
+        uint16_t target = static_cast<uint16_t>(next + static_cast<int8_t>(operand));
+        int taken = cycles + 1 + ((next & 0xff00) != (target & 0xff00));
+        line("if (%s(%s)) {", on_set ? "" : "!", flag);
+        line("    r.cycles += %d;", taken);
+        line("    return aot::leave(s, r, 0x%04x);", target);
+        line("}");
+        add_cycles(cycles);
+        return true;
+    }
+
+    // Accumulator shifts.
+    if (group == InstructionGroup::Type2 && mode == Addr_Accumulator) {
+        line("{");
+        if (op == ASL || op == ROL) {
+            line("    uint8_t carry = r.a >> 7;");
+            line("    r.a = static_cast<uint8_t>(r.a << 1%s);", op == ROL ? " | r.carry" : "");
+        } else {
+            line("    uint8_t carry = r.a & 1;");
+            line("    r.a = static_cast<uint8_t>(r.a >> 1%s);", op == ROR ? " | r.carry << 7" : "");
+        }
+        line("    r.carry = carry;");
+        line("}");
+        line("aot::set_zn(r, r.a);");
+        add_cycles(cycles);
+        return true;
+    }
+
+    Operand target = decode_operand(opcode, operand);
+    if (!target.fixed)
+        line("%s", target.ea.c_str());
+    if (group == InstructionGroup::Type1) {
+        switch (op) {
+        case ORA:
+        case AND:
+        case EOR:
+            line("r.a %s= %s;", op == ORA ? "|" : op == AND ? "&" : "^", load(target, first).c_str());
+            line("aot::set_zn(r, r.a);");
+            break;
+        case ADC:
+            line("aot::add_with_carry(r, %s);", load(target, first).c_str());
+            break;
+        case SBC:
+            line("aot::add_with_carry(r, static_cast<uint8_t>(~%s));", load(target, first).c_str());
+            break;
+        case STA:
+            store(target, "r.a", first);
+            break;
+        case LDA:
+            line("r.a = %s;", load(target, first).c_str());
+            line("aot::set_zn(r, r.a);");
+            break;
+        case CMP:
+            line("aot::compare(r, r.a, %s);", load(target, first).c_str());
+            break;
+        }
+    } else if (group == InstructionGroup::Type2) {
+        switch (op) {
+        case STX:
+            store(target, "r.x", first);
+            break;
+        case LDX:
+            line("r.x = %s;", load(target, first).c_str());
+            line("aot::set_zn(r, r.x);");
+            break;
+        default: {
+            // Read-modify-write.
+            bool shift = op == ASL || op == ROL || op == LSR || op == ROR;
+            line("{");
+            line("    uint8_t m = %s;", load(target, first).c_str());
+            if (op == ASL || op == ROL) {
+                line("    uint8_t carry = m >> 7;");
+                line("    m = static_cast<uint8_t>(m << 1%s);", op == ROL ? " | r.carry" : "");
+            } else if (op == LSR || op == ROR) {
+                line("    uint8_t carry = m & 1;");
+                line("    m = static_cast<uint8_t>(m >> 1%s);", op == ROR ? " | r.carry << 7" : "");
+            } else {
+                line("    %sm;", op == INC ? "++" : "--");
+            }
+            code += "    ";
+            store(target, "m", first);
+            if (shift)
+                line("    r.carry = carry;");
+            line("    aot::set_zn(r, m);");
+            line("}");
+            break;
+        }
+        }
+    } else {
+        switch (op) {
+        case BIT:
+            line("{");
+            line("    uint8_t m = %s;", load(target, first).c_str());
+            line("    r.zero_result = r.a & m;");
+            line("    r.negative_result = m;");
+            line("    r.overflow = (m >> 6) & 1;");
+            line("}");
+            break;
+        case STY:
+            store(target, "r.y", first);
+            break;
+        case LDY:
+            line("r.y = %s;", load(target, first).c_str());
+            line("aot::set_zn(r, r.y);");
+            break;
+        case CPX:
+            line("aot::compare(r, r.x, %s);", load(target, first).c_str());
+            break;
+        case CPY:
+            line("aot::compare(r, r.y, %s);", load(target, first).c_str());
+            break;
+        }
+    }
+    add_cycles(cycles, &target);
+
+    // Whatever the bus did (a DMA, an interrupt, a bank switch) is for the
+    // caller to see before anything else runs.
+    if (io)
+        line("if (s->io) return aot::leave(s, r, 0x%04x);", next);
+    return true;
+}
+
+std::string Generator::generate(const char *rom_path)
+{
+    std::string functions;
+    std::string table;
+    for (const auto &start : starts) {
+        const Location &at = start.first;
+        if (!decode(at.bank, at.offset).compilable)
+            continue;
+        code.clear();
+        block(at);
+        functions += code;
+
+        char entry[96];
+        std::snprintf(entry, sizeof(entry), "    {%u, %d, 0x%04x, b%u_%04x},\n", at.bank, at.window, at.offset,
+                      at.bank, at.address());
+        table += entry;
+        ++blocks;
+    }
+
+    char header[256];
+    std::string out;
+    std::snprintf(header, sizeof(header), "// Generated by nestastic_aot from %s: %zu blocks. Do not edit.\n",
+                  rom_path, blocks);
+    out += header;
+    out += "#include \"src/emu/CPU/aot_runtime.h\"\n\nnamespace {\n\n";
+    out += functions;
+    if (blocks > 0)
+        out += "const AotBlock blocks[] = {\n" + table + "};\n\n";
+    else
+        out += "const AotBlock *const blocks = nullptr;\n\n";
+    std::snprintf(header, sizeof(header), "const AotModuleInfo info = {AotAbiVersion, 0x%zx, 0x%016llxull, %zu, blocks};\n",
+                  prg_size, static_cast<unsigned long long>(AotModule::prg_hash(prg, prg_size)), blocks);
+    out += header;
+    out += "\n} // namespace\n\n"
+           "extern \"C\" const AotModuleInfo *nestastic_aot_module()\n"
+           "{\n"
+           "    return &info;\n"
+           "}\n";
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *rom_path = nullptr;
+    const char *output_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (std::strcmp(arg, "--rom") == 0 && has_value) {
+            rom_path = argv[++i];
+        } else if (std::strcmp(arg, "--output") == 0 && has_value) {
+            output_path = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!rom_path || !output_path) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    try {
+        std::shared_ptr<const RomImage> rom = RomImage::load(rom_path);
+        BusOptions options;
+        options.audio = false;
+        Bus bus(rom, options);
+
+        Generator generator(bus, *rom);
+        generator.walk();
+        std::string code = generator.generate(rom_path);
+
+        FILE *file = std::fopen(output_path, "wb");
+        if (!file || std::fwrite(code.data(), 1, code.size(), file) != code.size() || std::fclose(file) != 0) {
+            std::fprintf(stderr, "Failed to write %s\n", output_path);
+            return 1;
+        }
+        std::printf("%zu blocks, %zu instructions\n", generator.block_count(), generator.instruction_count());
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
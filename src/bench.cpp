@@ -0,0 +1,560 @@
+#include "emu/bus/bus.h"
+#include "emu/CPU/aot_module.h"
+#include "emu/batch/lockstep_cpu.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <vector>
+
+// Microbenchmarks for the emulation core. Each benchmark builds its own
+// synthetic ROM image in memory, so no ROM files are needed.
+
+struct BenchOptions {
+    double seconds = 1.0;
+    // Built from nestastic_aot's output for the mixed ROM (--write-mixed-rom).
+    std::shared_ptr<const AotModule> aot;
+};
+
+struct Benchmark {
+    const char *name;
+    const char *description;
+    void (*run)(const BenchOptions &options);
+};
+
+// Wraps 16KB of PRG (mirrored at $8000 and $C000) and 8KB of CHR in an iNES
+// header. The reset vector points at $8000; NMI and IRQ at `irq_handler`.
+static std::vector<uint8_t> nrom_file(const std::vector<uint8_t> &code, uint16_t irq_handler)
+{
+    std::vector<uint8_t> file = { 'N', 'E', 'S', 0x1A, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    std::vector<uint8_t> prg(0x4000, 0xEA);
+    std::memcpy(prg.data(), code.data(), code.size());
+
+    const uint16_t vectors[] = { irq_handler, 0x8000, irq_handler };
+    for (int i = 0; i < 3; ++i) {
+        prg[0x3FFA + i * 2] = vectors[i] & 0xFF;
+        prg[0x3FFB + i * 2] = vectors[i] >> 8;
+    }
+
+    file.insert(file.end(), prg.begin(), prg.end());
+    file.resize(file.size() + 0x2000, 0x00);
+    return file;
+}
+
+static std::shared_ptr<const RomImage> make_nrom(const std::vector<uint8_t> &code, uint16_t irq_handler)
+{
+    std::vector<uint8_t> file = nrom_file(code, irq_handler);
+    return RomImage::from_memory(file.data(), file.size());
+}
+
+// A loop touching every instruction group (implied, branch, type 0/1/2) and
+// most addressing modes, so dispatch cost dominates rather than one opcode.
+static std::vector<uint8_t> mixed_rom_file()
+{
+    return nrom_file({
+        0x78,             // 8000 SEI
+        0xD8,             // 8001 CLD
+        0xA2, 0xFF,       // 8002 LDX #$FF
+        0x9A,             // 8004 TXS
+        0xA9, 0x12,       // 8005 loop: LDA #$12
+        0x85, 0x10,       // 8007 STA $10
+        0xA5, 0x10,       // 8009 LDA $10
+        0x69, 0x01,       // 800B ADC #$01
+        0x9D, 0x00, 0x02, // 800D STA $0200,X
+        0xA4, 0x10,       // 8010 LDY $10
+        0xC8,             // 8012 INY
+        0xC0, 0x80,       // 8013 CPY #$80
+        0x0A,             // 8015 ASL A
+        0x66, 0x11,       // 8016 ROR $11
+        0x29, 0xF0,       // 8018 AND #$F0
+        0x11, 0x20,       // 801A ORA ($20),Y
+        0x4D, 0x00, 0x03, // 801C EOR $0300
+        0xE6, 0x12,       // 801F INC $12
+        0xCA,             // 8021 DEX
+        0xD0, 0xE1,       // 8022 BNE loop
+        0x20, 0x2A, 0x80, // 8024 JSR sub
+        0x4C, 0x05, 0x80, // 8027 JMP loop
+        0x48,             // 802A sub: PHA
+        0x68,             // 802B PLA
+        0x60,             // 802C RTS
+        0x40,             // 802D RTI
+    }, 0x802D);
+}
+
+static std::shared_ptr<const RomImage> make_mixed_rom()
+{
+    std::vector<uint8_t> file = mixed_rom_file();
+    return RomImage::from_memory(file.data(), file.size());
+}
+
+template<typename Step>
+static double time_loop(const BenchOptions &options, Step step, uint64_t &iterations, uint64_t batch = 100000)
+{
+    iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        for (uint64_t i = 0; i < batch; ++i) {
+            step();
+        }
+        iterations += batch;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < options.seconds);
+    return elapsed;
+}
+
+// Benchmarks build their consoles without audio, like the headless runner.
+static BusOptions bench_bus_options()
+{
+    BusOptions options;
+    options.audio = false;
+    return options;
+}
+
+// CPU alone (no PPU/APU): measures instruction decode and execution.
+static void bench_cpu_dispatch(const BenchOptions &options)
+{
+    Bus bus(make_mixed_rom(), bench_bus_options());
+    bus.cpu.reset();
+
+    uint64_t cycles = 0;
+    double seconds = time_loop(options, [&]() { bus.cpu.clock(); }, cycles);
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx NTSC)\n", "cpu_dispatch",
+                cycles / seconds / 1e6, cycles / seconds / 1789773.0);
+}
+
+// Whole console on the same program: CPU plus PPU and APU at bus level.
+static void bench_bus_clock(const BenchOptions &options)
+{
+    Bus bus(make_mixed_rom(), bench_bus_options());
+    bus.cpu.reset();
+
+    uint64_t dots = 0;
+    double seconds = time_loop(options, [&]() { bus.clock(); }, dots);
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx NTSC)\n", "bus_clock",
+                dots / 3 / seconds / 1e6, dots / 3 / seconds / 1789773.0);
+}
+
+// Same program through run_frame(): the CPU steps an instruction at a time
+// and the PPU and APU are caught up in batches.
+static void bench_run_frame(const BenchOptions &options)
+{
+    Bus bus(make_mixed_rom(), bench_bus_options());
+    bus.cpu.reset();
+
+    uint64_t frames = 0;
+    double seconds = time_loop(options, [&]() { bus.run_frame(); }, frames, 10);
+    double cycles = bus.cpu.getCycleCount();
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx NTSC)\n", "run_frame",
+                cycles / seconds / 1e6, cycles / seconds / 1789773.0);
+}
+
+// One superinstruction idiom in a loop, run through CPU::step() alone with
+// fusion allowed and not allowed. `body` is repeated `repeat` times and
+// followed by a JMP back to $8000.
+static void bench_idiom(const char *name, const std::vector<uint8_t> &body, int repeat, const BenchOptions &options)
+{
+    std::vector<uint8_t> code;
+    for (int i = 0; i < repeat; ++i) {
+        code.insert(code.end(), body.begin(), body.end());
+    }
+    code.insert(code.end(), { 0x4C, 0x00, 0x80 });
+
+    double rates[2];
+    for (int fused = 0; fused < 2; ++fused) {
+        Bus bus(make_nrom(code, 0x8000), bench_bus_options());
+        bus.cpu.reset();
+
+        int budget = fused ? 0xff : 0;
+        uint64_t steps = 0;
+        uint64_t cycles = 0;
+        double seconds = time_loop(options, [&]() { cycles += bus.cpu.step(budget); }, steps);
+        rates[fused] = cycles / seconds;
+    }
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx unfused)\n", name, rates[1] / 1e6, rates[1] / rates[0]);
+}
+
+static void bench_fused_lda_sta(const BenchOptions &options)
+{
+    // LDA $10 / STA $0200
+    bench_idiom("fused_lda_sta", { 0xA5, 0x10, 0x8D, 0x00, 0x02 }, 32, options);
+}
+
+static void bench_fused_dex_bne(const BenchOptions &options)
+{
+    // loop: DEX / BNE loop
+    bench_idiom("fused_dex_bne", { 0xCA, 0xD0, 0xFD }, 1, options);
+}
+
+static void bench_fused_lda_bpl(const BenchOptions &options)
+{
+    // loop: LDA $2002 / BPL loop (vblank never arrives, the PPU is not clocked)
+    bench_idiom("fused_lda_bpl", { 0xAD, 0x02, 0x20, 0x10, 0xFB }, 1, options);
+}
+
+static void bench_fused_inc_lda(const BenchOptions &options)
+{
+    // INC $10 / LDA $10
+    bench_idiom("fused_inc_lda", { 0xE6, 0x10, 0xA5, 0x10 }, 32, options);
+}
+
+// The mixed loop run through CPU::step() alone, interpreted and with hot code
+// compiled to x86-64. Every step may run up to 255 cycles, which compiled
+// blocks and superinstructions make use of.
+static void bench_jit_cpu(const BenchOptions &options)
+{
+    double rates[2];
+    for (int jit = 0; jit < 2; ++jit) {
+        BusOptions bus_options = bench_bus_options();
+        bus_options.jit = jit != 0;
+        Bus bus(make_mixed_rom(), bus_options);
+        bus.cpu.reset();
+
+        uint64_t steps = 0;
+        uint64_t cycles = 0;
+        double seconds = time_loop(options, [&]() { cycles += bus.cpu.step(0xff); }, steps);
+        rates[jit] = cycles / seconds;
+    }
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx interpreter)\n", "jit_cpu", rates[1] / 1e6, rates[1] / rates[0]);
+}
+
+// The mixed loop in whole frames, interpreted and compiled, taking turns a
+// few frames at a time.
+static void bench_jit_run_frame(const BenchOptions &options)
+{
+    std::vector<std::unique_ptr<Bus>> consoles;
+    for (int jit = 0; jit < 2; ++jit) {
+        BusOptions bus_options = bench_bus_options();
+        bus_options.jit = jit != 0;
+        consoles.push_back(std::make_unique<Bus>(make_mixed_rom(), bus_options));
+        consoles.back()->cpu.reset();
+    }
+
+    double seconds[2] = {};
+    do {
+        for (int jit = 0; jit < 2; ++jit) {
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = 0; frame < 10; ++frame) {
+                consoles[jit]->run_frame();
+            }
+            seconds[jit] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    } while (seconds[0] + seconds[1] < 2 * options.seconds);
+
+    double cycles = consoles[1]->cpu.getCycleCount();
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx interpreter)\n", "jit_run_frame",
+                cycles / seconds[1] / 1e6, seconds[0] / seconds[1]);
+}
+
+// The mixed loop run through CPU::step() alone, interpreted and from an AOT
+// module, like jit_cpu.
+static void bench_aot_cpu(const BenchOptions &options)
+{
+    if (!options.aot) {
+        std::printf("%-24s skipped (needs --aot)\n", "aot_cpu");
+        return;
+    }
+
+    double rates[2];
+    for (int aot = 0; aot < 2; ++aot) {
+        BusOptions bus_options = bench_bus_options();
+        if (aot) {
+            bus_options.aot = options.aot;
+        }
+        Bus bus(make_mixed_rom(), bus_options);
+        bus.cpu.reset();
+
+        uint64_t steps = 0;
+        uint64_t cycles = 0;
+        double seconds = time_loop(options, [&]() { cycles += bus.cpu.step(0xff); }, steps);
+        rates[aot] = cycles / seconds;
+    }
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx interpreter)\n", "aot_cpu", rates[1] / 1e6, rates[1] / rates[0]);
+}
+
+// Per-lane pseudo-random branches: an 8-bit LFSR seeded from $00 decides
+// each iteration whether to increment $01 or decrement $02.
+static std::shared_ptr<const RomImage> make_branchy_rom()
+{
+    return make_nrom({
+        0x78,             // 8000 SEI
+        0xD8,             // 8001 CLD
+        0xA2, 0xFF,       // 8002 LDX #$FF
+        0x9A,             // 8004 TXS
+        0xA5, 0x00,       // 8005 loop: LDA $00
+        0x0A,             // 8007 ASL A
+        0x90, 0x02,       // 8008 BCC store
+        0x49, 0x1D,       // 800A EOR #$1D
+        0x85, 0x00,       // 800C store: STA $00
+        0x29, 0x01,       // 800E AND #$01
+        0xF0, 0x05,       // 8010 BEQ even
+        0xE6, 0x01,       // 8012 INC $01
+        0x4C, 0x05, 0x80, // 8014 JMP loop
+        0xC6, 0x02,       // 8017 even: DEC $02
+        0x4C, 0x05, 0x80, // 8019 JMP loop
+    }, 0x8000);
+}
+
+// Lanes consoles running one CPU-bound program: the scalar CPU class steps
+// them one after another, then LockstepCPU runs them together for the same
+// number of cycles. Lane n starts with n + 1 at $00, so data-dependent
+// branches can split the lanes up. Every lane must end up identical.
+template<int Lanes>
+static void bench_lockstep(const char *name, std::shared_ptr<const RomImage> rom, const BenchOptions &options)
+{
+    const uint64_t slice = 100000;
+
+    std::vector<std::unique_ptr<Bus>> consoles;
+    std::vector<uint64_t> scalar_cycles(Lanes, 0);
+    for (int lane = 0; lane < Lanes; ++lane) {
+        consoles.push_back(std::make_unique<Bus>(rom, bench_bus_options()));
+        consoles.back()->cpu.reset();
+        consoles.back()->ram[0] = static_cast<uint8_t>(lane + 1);
+    }
+
+    uint64_t target = 0;
+    auto start = std::chrono::steady_clock::now();
+    double scalar_seconds = 0.0;
+    do {
+        target += slice;
+        for (int lane = 0; lane < Lanes; ++lane) {
+            while (scalar_cycles[lane] < target) {
+                scalar_cycles[lane] += consoles[lane]->cpu.step();
+            }
+        }
+        scalar_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (scalar_seconds < options.seconds);
+
+    LockstepCPU<Lanes> lockstep(rom);
+    for (int lane = 0; lane < Lanes; ++lane) {
+        lockstep.write_ram(lane, 0, static_cast<uint8_t>(lane + 1));
+    }
+    start = std::chrono::steady_clock::now();
+    for (uint64_t cycles = slice; cycles <= target; cycles += slice) {
+        lockstep.run(cycles);
+    }
+    double lockstep_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool same = true;
+    for (int lane = 0; lane < Lanes; ++lane) {
+        CPURegisters expected = consoles[lane]->cpu.get_regs();
+        CPURegisters actual = lockstep.get_regs(lane);
+        same = same && !lockstep.stopped(lane) && lockstep.get_cycles(lane) == scalar_cycles[lane] &&
+               actual.pc == expected.pc && actual.a == expected.a && actual.x == expected.x &&
+               actual.y == expected.y && actual.sp == expected.sp && actual.status == expected.status;
+        for (uint16_t addr = 0; addr < LockstepCPU<Lanes>::RAM_SIZE; ++addr) {
+            same = same && lockstep.read_ram(lane, addr) == consoles[lane]->ram[addr];
+        }
+    }
+
+    double cycles = static_cast<double>(target) * Lanes;
+    double steps = static_cast<double>(lockstep.converged_steps() + lockstep.diverged_steps());
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx scalar, %.0f%% of steps converged, %s gathers)%s\n", name,
+                cycles / lockstep_seconds / 1e6, scalar_seconds / lockstep_seconds,
+                steps > 0.0 ? 100.0 * lockstep.converged_steps() / steps : 0.0,
+                lockstep.uses_avx2() ? "AVX2" : "scalar", same ? "" : " MISMATCH");
+}
+
+static void bench_lockstep8_mixed(const BenchOptions &options)
+{
+    bench_lockstep<8>("lockstep8_mixed", make_mixed_rom(), options);
+}
+
+static void bench_lockstep16_mixed(const BenchOptions &options)
+{
+    bench_lockstep<16>("lockstep16_mixed", make_mixed_rom(), options);
+}
+
+static void bench_lockstep8_branchy(const BenchOptions &options)
+{
+    bench_lockstep<8>("lockstep8_branchy", make_branchy_rom(), options);
+}
+
+static void bench_lockstep16_branchy(const BenchOptions &options)
+{
+    bench_lockstep<16>("lockstep16_branchy", make_branchy_rom(), options);
+}
+
+// The same 16KB of code in every PRG bank, so the program runs on whatever
+// the mapper switches in, with rendering on so the PPU fetches pattern and
+// nametable bytes every dot. The loop reads PRG ROM and RAM through the bus
+// and writes a new bank number to $8000 every 256 iterations.
+static std::shared_ptr<const RomImage> make_banked_rom(uint8_t mapper, uint8_t prg_banks, uint8_t chr_banks)
+{
+    const std::vector<uint8_t> code = {
+        0x78,             // 8000 SEI
+        0xD8,             // 8001 CLD
+        0xA2, 0xFF,       // 8002 LDX #$FF
+        0x9A,             // 8004 TXS
+        0xA9, 0x1E,       // 8005 LDA #$1E
+        0x8D, 0x01, 0x20, // 8007 STA $2001
+        0xBD, 0x00, 0x90, // 800A loop: LDA $9000,X
+        0x5D, 0x00, 0xE0, // 800D EOR $E000,X
+        0x9D, 0x00, 0x03, // 8010 STA $0300,X
+        0x7D, 0x00, 0x60, // 8013 ADC $6000,X
+        0x9D, 0x00, 0x60, // 8016 STA $6000,X
+        0xCA,             // 8019 DEX
+        0xD0, 0xEE,       // 801A BNE loop
+        0xE6, 0x10,       // 801C INC $10
+        0xA5, 0x10,       // 801E LDA $10
+        0x8D, 0x00, 0x80, // 8020 STA $8000
+        0x4C, 0x0A, 0x80, // 8023 JMP loop
+        0x40,             // 8026 RTI
+    };
+    const uint16_t vectors[] = { 0x8026, 0x8000, 0x8026 };
+
+    std::vector<uint8_t> bank(0x4000, 0xEA);
+    std::memcpy(bank.data(), code.data(), code.size());
+    for (int i = 0; i < 3; ++i) {
+        bank[0x3FFA + i * 2] = vectors[i] & 0xFF;
+        bank[0x3FFB + i * 2] = vectors[i] >> 8;
+    }
+
+    std::vector<uint8_t> file = {
+        'N', 'E', 'S', 0x1A, prg_banks, chr_banks,
+        static_cast<uint8_t>((mapper & 0x0F) << 4), static_cast<uint8_t>(mapper & 0xF0), 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    for (int i = 0; i < prg_banks; ++i) {
+        file.insert(file.end(), bank.begin(), bank.end());
+    }
+    for (size_t i = 0; i < chr_banks * 0x2000u; ++i) {
+        file.push_back(static_cast<uint8_t>(i * 7));
+    }
+    return RomImage::from_memory(file.data(), file.size());
+}
+
+// Whole frames on one mapper, with cartridge memory accessed through the bus
+// and PPU page tables and through the Mapper interface. The two consoles take
+// turns, a few frames at a time, so both see the same machine conditions.
+static void bench_mapper(const char *name, uint8_t mapper, uint8_t prg_banks, uint8_t chr_banks, const BenchOptions &options)
+{
+    std::shared_ptr<const RomImage> rom = make_banked_rom(mapper, prg_banks, chr_banks);
+
+    std::vector<std::unique_ptr<Bus>> consoles;
+    for (int tables = 0; tables < 2; ++tables) {
+        BusOptions bus_options = bench_bus_options();
+        bus_options.page_tables = tables != 0;
+        consoles.push_back(std::make_unique<Bus>(rom, bus_options));
+        consoles.back()->cpu.reset();
+    }
+
+    double seconds[2] = {};
+    do {
+        for (int tables = 0; tables < 2; ++tables) {
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = 0; frame < 10; ++frame) {
+                consoles[tables]->run_frame();
+            }
+            seconds[tables] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    } while (seconds[0] + seconds[1] < 2 * options.seconds);
+
+    // Both ran the same number of frames, so the same number of cycles.
+    double cycles = consoles[1]->cpu.getCycleCount();
+    std::printf("%-24s %8.2f M CPU cycles/s (%.2fx mapper interface)\n", name,
+                cycles / seconds[1] / 1e6, seconds[0] / seconds[1]);
+}
+
+static void bench_mapper_000(const BenchOptions &options) { bench_mapper("mapper_000", 0, 2, 1, options); }
+static void bench_mapper_001(const BenchOptions &options) { bench_mapper("mapper_001", 1, 8, 4, options); }
+static void bench_mapper_002(const BenchOptions &options) { bench_mapper("mapper_002", 2, 8, 0, options); }
+static void bench_mapper_003(const BenchOptions &options) { bench_mapper("mapper_003", 3, 2, 4, options); }
+static void bench_mapper_007(const BenchOptions &options) { bench_mapper("mapper_007", 7, 8, 0, options); }
+static void bench_mapper_011(const BenchOptions &options) { bench_mapper("mapper_011", 11, 8, 4, options); }
+static void bench_mapper_066(const BenchOptions &options) { bench_mapper("mapper_066", 66, 8, 4, options); }
+
+static const Benchmark benchmarks[] = {
+    { "cpu_dispatch", "CPU only, mixed instruction loop", bench_cpu_dispatch },
+    { "bus_clock", "CPU + PPU + APU, mixed instruction loop", bench_bus_clock },
+    { "run_frame", "CPU + PPU + APU, mixed instruction loop, whole frames", bench_run_frame },
+    { "fused_lda_sta", "CPU only, LDA zp / STA abs superinstruction vs unfused", bench_fused_lda_sta },
+    { "fused_dex_bne", "CPU only, DEX / BNE superinstruction vs unfused", bench_fused_dex_bne },
+    { "fused_lda_bpl", "CPU only, LDA $2002 / BPL superinstruction vs unfused", bench_fused_lda_bpl },
+    { "fused_inc_lda", "CPU only, INC zp / LDA zp superinstruction vs unfused", bench_fused_inc_lda },
+    { "jit_cpu", "CPU only, mixed instruction loop, x86-64 JIT vs interpreter", bench_jit_cpu },
+    { "jit_run_frame", "CPU + PPU + APU, mixed instruction loop, whole frames, JIT vs interpreter", bench_jit_run_frame },
+    { "aot_cpu", "CPU only, mixed instruction loop, AOT module (--aot) vs interpreter", bench_aot_cpu },
+    { "lockstep8_mixed", "8 CPUs in lockstep vs scalar, mixed instruction loop", bench_lockstep8_mixed },
+    { "lockstep16_mixed", "16 CPUs in lockstep vs scalar, mixed instruction loop", bench_lockstep16_mixed },
+    { "lockstep8_branchy", "8 CPUs in lockstep vs scalar, data-dependent branches", bench_lockstep8_branchy },
+    { "lockstep16_branchy", "16 CPUs in lockstep vs scalar, data-dependent branches", bench_lockstep16_branchy },
+    { "mapper_000", "NROM, whole frames, page tables vs mapper interface", bench_mapper_000 },
+    { "mapper_001", "MMC1, whole frames, page tables vs mapper interface", bench_mapper_001 },
+    { "mapper_002", "UxROM, whole frames, page tables vs mapper interface", bench_mapper_002 },
+    { "mapper_003", "CNROM, whole frames, page tables vs mapper interface", bench_mapper_003 },
+    { "mapper_007", "AxROM, whole frames, page tables vs mapper interface", bench_mapper_007 },
+    { "mapper_011", "Color Dreams, whole frames, page tables vs mapper interface", bench_mapper_011 },
+    { "mapper_066", "GxROM, whole frames, page tables vs mapper interface", bench_mapper_066 },
+};
+
+static void print_usage(const char *argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s [--seconds S] [--aot <module>] [--list] [name...]\n"
+        "       %s --write-mixed-rom <file.nes>\n"
+        "\n"
+        "  --seconds S              minimum run time per benchmark (default 1)\n"
+        "  --aot <module>           module built from nestastic_aot's output for the\n"
+        "                           mixed ROM, for aot_cpu\n"
+        "  --write-mixed-rom <file> write the mixed instruction loop ROM and exit\n"
+        "  --list                   list benchmarks\n"
+        "  name...                  only run these benchmarks (default: all)\n",
+        argv0, argv0);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    std::vector<const char*> selected;
+    const char *aot_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (std::strcmp(arg, "--seconds") == 0 && i + 1 < argc) {
+            options.seconds = std::strtod(argv[++i], nullptr);
+        } else if (std::strcmp(arg, "--aot") == 0 && i + 1 < argc) {
+            aot_path = argv[++i];
+        } else if (std::strcmp(arg, "--write-mixed-rom") == 0 && i + 1 < argc) {
+            std::vector<uint8_t> file = mixed_rom_file();
+            FILE *out = std::fopen(argv[++i], "wb");
+            if (!out || std::fwrite(file.data(), 1, file.size(), out) != file.size() || std::fclose(out) != 0) {
+                std::fprintf(stderr, "Failed to write %s\n", argv[i]);
+                return 1;
+            }
+            return 0;
+        } else if (std::strcmp(arg, "--list") == 0) {
+            for (const Benchmark &benchmark : benchmarks) {
+                std::printf("%-24s %s\n", benchmark.name, benchmark.description);
+            }
+            return 0;
+        } else if (arg[0] == '-') {
+            print_usage(argv[0]);
+            return 2;
+        } else {
+            selected.push_back(arg);
+        }
+    }
+
+    try {
+        if (aot_path) {
+            options.aot = AotModule::load(aot_path);
+        }
+        for (const Benchmark &benchmark : benchmarks) {
+            bool run = selected.empty();
+            for (const char *name : selected) {
+                run = run || std::strcmp(name, benchmark.name) == 0;
+            }
+            if (run) {
+                benchmark.run(options);
+            }
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include "pulse.h"
 #include "spsc.hpp"
 #include "constants.h"
+#include <algorithm>
 #include <cstdio>
 
 using namespace std::chrono;
@@ -62,12 +63,31 @@ float mix(uint8_t pulse1, uint8_t pulse2, uint8_t triangle, uint8_t noise, uint8
     return pulse_out + tnd_out;
 }
 
+void APU::copy_state(const APU &other)
+{
+    pulse1        = other.pulse1;
+    pulse2        = other.pulse2;
+    triangle      = other.triangle;
+    noise         = other.noise;
+    dmc           = other.dmc;
+    frame_counter = other.frame_counter;
+    divideByTwo   = other.divideByTwo;
+}
+
 void APU::step()
 {
-    // Periodic diagnostics added: print occasional status to stderr to help
-    // track APU internal timing/state when debugging corrupted audio.
-    static uint64_t step_counter = 0;
-    ++step_counter;
+    if (!audio_enabled)
+    {
+        // Only the parts with CPU-visible side effects. Length counters are
+        // clocked by the frame counter, so $4015 stays exact.
+        dmc.clock();
+        if (divideByTwo)
+        {
+            frame_counter.clock();
+        }
+        divideByTwo = !divideByTwo;
+        return;
+    }
 
     // Clock components that run at CPU frequency
     noise.clock();
@@ -86,15 +106,58 @@ void APU::step()
     // Each APU::step() corresponds to one CPU cycle elapsed; advance the sampling_timer
     // by the CPU clock period and push any samples that became due.
     int samples_to_push = sampling_timer.clock(cpu_clock_period_ns);
-    for (int i = 0; i < samples_to_push; ++i)
+    for (int i = 0; audio_queue && i < samples_to_push; ++i)
     {
         float mixed = mix(pulse1.sample(), pulse2.sample(), triangle.sample(), noise.sample(), dmc.sample());
-        audio_queue.push(mixed);
+        audio_queue->push(mixed);
     }
 
     divideByTwo = !divideByTwo;
 }
 
+void APU::run(int steps)
+{
+    if (audio_enabled)
+    {
+        for (; steps > 0; --steps)
+        {
+            step();
+        }
+        return;
+    }
+
+    while (steps > 0)
+    {
+        int quiet = std::min(steps, steps_until_frame_counter() - 1);
+        int dmc_steps = steps_until_dmc();
+        if (dmc_steps > 0)
+        {
+            quiet = std::min(quiet, dmc_steps - 1);
+        }
+
+        // The frame counter is clocked on every other step, starting with
+        // this one if divideByTwo is set.
+        frame_counter.advance((quiet + divideByTwo) / 2);
+        dmc.advance(quiet);
+        if (quiet & 1)
+        {
+            divideByTwo = !divideByTwo;
+        }
+        steps -= quiet;
+
+        if (steps > 0)
+        {
+            step();
+            --steps;
+        }
+    }
+}
+
+int APU::steps_until_frame_counter() const
+{
+    return 2 * frame_counter.clocks_until_step() - divideByTwo;
+}
+
 void APU::writeRegister(uint16_t addr, uint8_t value)
 {
     switch (addr)
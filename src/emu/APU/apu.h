@@ -1,6 +1,5 @@
 #pragma once
 
-#include "AudioPlayer.h"
 #include "dmc.h"
 #include "frame_counter.h"
 #include "noise.h"
@@ -22,22 +21,46 @@ public:
     FrameCounter frame_counter;
 
 public:
-    APU(AudioPlayer& player, IRQ& irq, std::function<uint8_t(uint16_t)> dmcDma) :
+    // With audio == false the APU only emulates what the CPU can observe: the
+    // frame counter (length counters, $4015 status, frame IRQ) and the DMC
+    // (sample DMA and IRQ). Channel waveforms, sampling and mixing are skipped.
+    APU(IRQ& irq, std::function<uint8_t(uint16_t)> dmcDma, int sample_rate = 44100, bool audio = true) :
       dmc(irq, dmcDma),
       frame_counter(setup_frame_counter(irq)),
-      audio_queue(player.audio_queue),
-      sampling_timer(nanoseconds(int64_t(1e9) / int64_t(player.output_sample_rate))) {}
+      audio_enabled(audio),
+      sampling_timer(nanoseconds(int64_t(1e9) / int64_t(sample_rate))) {}
 
     // clock at the same frequency as the cpu
     void step();
 
+    // Same as `steps` step() calls. Without audio, the stretches in between
+    // frame-counter steps and DMC output clocks are skipped in one go.
+    void run(int steps);
+
+    // step() calls up to and including the next one that steps the frame
+    // counter / clocks the DMC output unit (-1: DMC disabled). These are the
+    // only steps with effects the CPU can see.
+    int steps_until_frame_counter() const;
+    int steps_until_dmc() const { return dmc.clocks_until_output(); }
+
+    // Attach the queue mixed samples are pushed into (normally an AudioPlayer's
+    // audio_queue). With no queue attached the APU still runs but skips mixing.
+    // Has no effect on an APU constructed without audio.
+    void set_audio_queue(spsc::RingBuffer<float> *queue) { audio_queue = audio_enabled ? queue : nullptr; }
+    bool has_audio() const { return audio_enabled; }
+
+    // Copies all channel and sequencer state from another APU. The audio queue
+    // and sample pacing are per-instance and are not copied.
+    void copy_state(const APU &other);
+
     void writeRegister(uint16_t addr, uint8_t value);
     uint8_t readStatus();
 
 private:
     FrameCounter             setup_frame_counter(IRQ &irq);
     bool                     divideByTwo = false;
+    const bool               audio_enabled;
 
-    spsc::RingBuffer<float> &audio_queue;
+    spsc::RingBuffer<float> *audio_queue = nullptr;
     Timer sampling_timer;
 };
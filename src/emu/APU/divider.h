@@ -22,6 +22,10 @@ public:
     void reset() { counter = period; }
 
     int  get_period() const { return period; }
+    int  get_counter() const { return counter; }
+
+    // Equivalent to n clock()s that all return false (n <= get_counter()).
+    void advance(int n) { counter -= n; }
 
 private:
     int period  = 0;
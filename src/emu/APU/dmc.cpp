@@ -1,6 +1,24 @@
 #include "dmc.h"
 #include "divider.h"
 
+DMC& DMC::operator=(const DMC &other) {
+    irqEnable = other.irqEnable;
+    loop = other.loop;
+    volume = other.volume;
+    change_enabled = other.change_enabled;
+    change_rate = other.change_rate;
+    sample_begin = other.sample_begin;
+    sample_length = other.sample_length;
+    remaining_bytes = other.remaining_bytes;
+    current_address = other.current_address;
+    sample_buffer = other.sample_buffer;
+    shifter = other.shifter;
+    remaining_bits = other.remaining_bits;
+    silenced = other.silenced;
+    interrupt = other.interrupt;
+    return *this;
+}
+
 void DMC::set_irq_enable(bool enable) {
     irqEnable = enable;
     if (!irqEnable)
@@ -37,9 +37,18 @@ struct DMC
 
     DMC(IRQ& irq, std::function<uint8_t(uint16_t)> dma) : irq(irq), dma(dma) {}
 
+    // Copies the channel state but keeps this DMC's IRQ line and DMA callback.
+    DMC& operator=(const DMC &other);
+
     // Clocked at the cpu freq
     void clock();
 
+    // clock() calls up to and including the next one that clocks the output
+    // unit (and may fetch a sample or raise the IRQ); -1 while disabled.
+    int clocks_until_output() const { return change_enabled ? change_rate.get_counter() + 1 : -1; }
+    // Equivalent to `clocks` clock()s that don't clock the output unit.
+    void advance(int clocks) { if (change_enabled) change_rate.advance(clocks); }
+
     uint8_t sample() const;
 
     bool has_more_samples() const { return remaining_bytes > 0; }
@@ -1,5 +1,16 @@
 #include "frame_counter.h"
 
+#include <initializer_list>
+
+FrameCounter& FrameCounter::operator=(const FrameCounter &other)
+{
+    mode              = other.mode;
+    counter           = other.counter;
+    interrupt_inhibit = other.interrupt_inhibit;
+    frame_interrupt   = other.frame_interrupt;
+    return *this;
+}
+
 void FrameCounter::clearFrameInterrupt()
 {
     if (frame_interrupt)
@@ -27,6 +38,18 @@ void FrameCounter::reset(Mode m, bool irq_inhibit)
     }
 }
 
+int FrameCounter::clocks_until_step() const
+{
+    // Steps that do nothing in the current mode are included; they only make
+    // the caller stop early. The counter always wraps at seq5step_length.
+    for (int step : { Q1, Q2, Q3, Q4, seq4step_length, Q5 }) {
+        if (step > counter) {
+            return step - counter;
+        }
+    }
+    return seq5step_length - counter;
+}
+
 // clocked at apu freq (half the cpu freq)
 void FrameCounter::clock() {
     counter += 1;
@@ -38,7 +38,15 @@ struct FrameCounter {
 
     FrameCounter(std::vector<std::reference_wrapper<FrameClockable>> slots, IRQ& irq): frame_slots(slots), irq(irq) {}
 
+    // Copies the sequencer state; slots and the IRQ line stay bound to this APU.
+    FrameCounter& operator=(const FrameCounter &other);
+
     void clearFrameInterrupt();
     void clock();
+
+    // clock() calls up to and including the next one that steps the sequencer.
+    int clocks_until_step() const;
+    // Equivalent to `clocks` clock()s that don't step the sequencer.
+    void advance(int clocks) { counter += clocks; }
     void reset(Mode m, bool irq_inhibit);
 };
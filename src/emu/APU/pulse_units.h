@@ -45,6 +45,19 @@ struct Sweep : public FrameClockable
 
     Sweep(Pulse& pulse, bool ones_complement) : pulse(pulse), ones_complement(ones_complement) {}
 
+    // Copies the sweep state; the unit stays bound to its own pulse channel.
+    Sweep& operator=(const Sweep &other)
+    {
+        period          = other.period;
+        enabled         = other.enabled;
+        reload          = other.reload;
+        negate          = other.negate;
+        shift           = other.shift;
+        ones_complement = other.ones_complement;
+        divider         = other.divider;
+        return *this;
+    }
+
     void half_frame_clock() override;
 
     static bool is_muted(int current, int target) { return current < 8 || target > 0x7FF; }
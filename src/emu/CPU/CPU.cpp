@@ -1,15 +1,57 @@
 #include "CPU.h"
 #include "opcodes.h"
+#include "jit_x64.h"
+#include "aot_module.h"
 #include <cstdint>
+#include <cstdio>
 #include "../bus/bus.h" // IWYU pragma: keep
 
-static struct {
+static const struct {
     uint16_t nmi;
     uint16_t reset;
     uint16_t irq;
 } vectors = {0xfffa, 0xfffc, 0xfffe};
 
-CPU::CPU(Bus& mem) : pendingNMI(false), bus(mem) {};
+// The bus as compiled blocks see it; see BlockState.
+static uint32_t block_read(BlockState *state, uint32_t addr)
+{
+    state->io = 1;
+    return state->bus->read(static_cast<uint16_t>(addr));
+}
+
+static void block_write(BlockState *state, uint32_t addr, uint32_t value)
+{
+    state->io = 1;
+    state->bus->write(static_cast<uint16_t>(addr), static_cast<uint8_t>(value));
+}
+
+static uint32_t block_read_cart(BlockState *state, uint32_t addr)
+{
+    return state->bus->read(static_cast<uint16_t>(addr));
+}
+
+static void block_write_cart(BlockState *state, uint32_t addr, uint32_t value)
+{
+    const Mapper &mapper = *state->bus->cart->mapper;
+    uint32_t version = mapper.get_prg_version();
+    state->bus->write(static_cast<uint16_t>(addr), static_cast<uint8_t>(value));
+    if (mapper.get_prg_version() != version)
+        state->io = 1;
+}
+
+CPU::CPU(Bus& mem) : ram(mem.ram), pendingNMI(false), bus(mem)
+{
+    block_state.ram = ram;
+    block_state.read_pages = mem.get_read_pages();
+    block_state.write_pages = mem.get_write_pages();
+    block_state.bus = &mem;
+    block_state.read = block_read;
+    block_state.write = block_write;
+    block_state.read_cart = block_read_cart;
+    block_state.write_cart = block_write_cart;
+}
+
+CPU::~CPU() = default;
 
 CPURegisters CPU::get_regs() const
 {
@@ -19,10 +61,43 @@ CPURegisters CPU::get_regs() const
     state.x = regs.x;
     state.y = regs.y;
     state.sp = regs.sp;
-    state.status = flags.all;
+    state.status = get_flags().all;
     return state;
 }
 
+CPUFlags CPU::get_flags() const
+{
+    CPUFlags current = flags;
+    current.C = carry;
+    current.Z = !zero_result;
+    current.V = overflow;
+    current.N = (negative_result & 0x80) != 0;
+    return current;
+}
+
+void CPU::set_status(uint8_t status)
+{
+    flags.all = status;
+    carry = flags.C;
+    overflow = flags.V;
+    zero_result = !flags.Z;
+    negative_result = flags.N ? 0x80 : 0;
+}
+
+void CPU::copy_state(const CPU &other)
+{
+    skipCycles = other.skipCycles;
+    cycles = other.cycles;
+    regs = other.regs;
+    flags = other.flags;
+    carry = other.carry;
+    overflow = other.overflow;
+    zero_result = other.zero_result;
+    negative_result = other.negative_result;
+    pendingNMI = other.pendingNMI;
+    m_irqPulldowns = other.m_irqPulldowns;
+}
+
 void CPU::reset()
 {
     reset(read_address(vectors.reset));
@@ -41,11 +116,11 @@ void CPU::reset(uint16_t start_addr)
 
     flags.I = 1;
 
-    flags.C = 0;
+    carry = 0;
     flags.D = 0;
-    flags.N = 0;
-    flags.V = 0;
-    flags.Z = 0;
+    negative_result = 0;
+    overflow = 0;
+    zero_result = 1;
 
 }
 
@@ -96,7 +171,7 @@ void CPU::interruptSequence(InterruptType type)
     stack_push(regs.pc);
 
     flags.B = (type == INTR_BRK);
-    stack_push(flags.all);
+    stack_push(get_flags().all);
 
     flags.I = true;
 
@@ -116,19 +191,13 @@ void CPU::interruptSequence(InterruptType type)
 
 void CPU::stack_push(uint8_t value)
 {
-    this->bus.write(0x100 | regs.sp, value);
+    ram[0x100 | regs.sp] = value;
     --regs.sp;
 }
 
 uint8_t CPU::stack_pop()
 {
-    return this->bus.read(0x100 | ++regs.sp);
-}
-
-void CPU::set_zn(uint8_t value)
-{
-    flags.Z = !value;
-    flags.N = (value & 0x80) != 0;
+    return ram[0x100 | ++regs.sp];
 }
 
 void CPU::skipPageCrossCycle(uint16_t a, uint16_t b)
@@ -152,11 +221,17 @@ void CPU::skipDMCDMACycles()
 
 void CPU::clock()
 {
-    ++cycles;
-
-    if (skipCycles-- > 1)
+    if (skipCycles > 1) {
+        idle_cycles();
         return;
+    }
+
+    step();
+}
 
+int CPU::step(int budget)
+{
+    ++cycles;
     skipCycles = 0;
 
     // NMI has higher priority, check for it first
@@ -164,28 +239,355 @@ void CPU::clock()
     {
         interruptSequence(INTR_NMI);
         this->pendingNMI = false;
-        return;
+        return skipCycles;
     }
     else if (isPendingIRQ())
     {
         interruptSequence(INTR_IRQ);
-        return;
+        return skipCycles;
+    }
+
+    if (regs.pc >= 0x8000 && bus.cart && bus.cart->mapper && bus.get_options().decode_cache) {
+        if (prg_windows_version != bus.cart->mapper->get_prg_version())
+            map_prg_windows();
+        const DecodedInstruction *window = prg_windows[(regs.pc >> 13) & 0x3];
+        if (window) {
+            if ((aot || jit) && run_compiled(budget))
+                return skipCycles;
+            const DecodedInstruction &decoded = window[regs.pc & 0x1fff];
+            if (decoded.handler) {
+                decoded_entry = &decoded;
+                decoded_operand = decoded.operand;
+                regs.pc += decoded.length;
+                if (decoded.fused && decoded.first_cycles <= budget && bus.get_options().superinstructions)
+                    decoded.fused(*this);
+                else
+                    decoded.handler(*this);
+                return skipCycles;
+            }
+        }
     }
 
     uint8_t opcode = this->bus.read(regs.pc++);
+    handlers[opcode](*this);
+    return skipCycles;
+}
+
+void CPU::map_prg_windows()
+{
+    const Cartridge &cart = *bus.cart;
+    prg_windows_version = cart.mapper->get_prg_version();
+    if (decoded_banks.empty())
+        decoded_banks.resize(cart.prg_size / 0x2000);
+    aot = bus.get_options().aot.get();
+    if (bus.get_options().jit && !jit)
+        jit.reset(new JitX64(cart.prg, cart.prg_size));
+
+    for (int window = 0; window < 4; ++window) {
+        prg_windows[window] = nullptr;
+
+        // Only cache windows that map linearly onto a whole 8KB ROM bank.
+        uint16_t addr = 0x8000 + window * 0x2000;
+        uint32_t first = UINT32_MAX, last = UINT32_MAX;
+        uint8_t data = 0;
+        if (!cart.mapper->prgRead(addr, first, data) || !cart.mapper->prgRead(addr + 0x1fff, last, data))
+            continue;
+        if ((first & 0x1fff) || last != first + 0x1fff || last >= cart.prg_size)
+            continue;
+
+        prg_window_banks[window] = first / 0x2000;
+        std::unique_ptr<DecodedInstruction[]> &bank = decoded_banks[first / 0x2000];
+        if (!bank)
+            bank = decode_bank(cart.prg + first);
+        prg_windows[window] = bank.get();
+    }
+}
+
+bool CPU::run_compiled(int budget)
+{
+    int window = (regs.pc >> 13) & 0x3;
+    uint32_t bank = prg_window_banks[window];
+    uint16_t offset = regs.pc & 0x1fff;
+    CompiledBlock block = aot ? aot->block(bank, window, offset) : nullptr;
+    if (!block && jit)
+        block = jit->block(bank, window, offset);
+    if (!block)
+        return false;
+
+    // Compiled code keeps the flags the way the interpreter does.
+    BlockState &state = block_state;
+    state.a = regs.a;
+    state.x = regs.x;
+    state.y = regs.y;
+    state.sp = regs.sp;
+    state.carry = carry;
+    state.overflow = overflow;
+    state.zero_result = zero_result;
+    state.negative_result = negative_result;
+    state.flags = flags.all;
+    state.io = 0;
+    state.budget = budget;
+
+    block(&state);
+
+    regs.pc = state.pc;
+    regs.a = state.a;
+    regs.x = state.x;
+    regs.y = state.y;
+    regs.sp = state.sp;
+    flags.all = state.flags;
+    carry = state.carry;
+    overflow = state.overflow;
+    zero_result = state.zero_result;
+    negative_result = state.negative_result;
+    skipCycles = state.cycles;
+    return true;
+}
+
+int CPU::idle_loop_at(uint16_t addr, bool &reads_status) const
+{
+    if (addr < 0x8000 || !bus.cart || !bus.cart->mapper || !bus.get_options().decode_cache)
+        return 0;
+    if (prg_windows_version != bus.cart->mapper->get_prg_version())
+        return 0;
+    const DecodedInstruction *window = prg_windows[(addr >> 13) & 0x3];
+    if (!window)
+        return 0;
+    const DecodedInstruction &decoded = window[addr & 0x1fff];
+    reads_status = decoded.idle_loop_reads_status;
+    return decoded.idle_loop;
+}
+
+// What an instruction may touch for it to be part of an idle loop.
+enum class IdleAccess {
+    Unsafe,   // writes, uses the stack, jumps, or reads anything else
+    Pure,     // registers and internal RAM only
+    Status,   // reads PPUSTATUS
+};
+
+static IdleAccess idle_access(const uint8_t *code)
+{
+    uint8_t opcode = code[0];
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+    uint16_t address = code[1] | code[2] << 8;
+    // Indexed reads must stay in internal RAM whatever the index.
+    auto absolute = [address](bool indexed) {
+        if (indexed)
+            return address + 0xff < 0x2000 ? IdleAccess::Pure : IdleAccess::Unsafe;
+        if (address < 0x2000)
+            return IdleAccess::Pure;
+        return address == 0x2002 ? IdleAccess::Status : IdleAccess::Unsafe;
+    };
+
+    switch (instruction_group(opcode)) {
+    case InstructionGroup::Implied:
+        switch (opcode) {
+        case NOP: case DEY: case DEX: case TAY: case INY: case INX:
+        case CLC: case SEC: case TYA: case CLV: case TXA: case TAX: case TSX:
+            return IdleAccess::Pure;
+        }
+        return IdleAccess::Unsafe;
+    case InstructionGroup::Type1:
+        if (op == STA || mode == IndexedIndirectX || mode == IndirectY)
+            return IdleAccess::Unsafe;
+        if (mode == Absolute || mode == AbsoluteX || mode == AbsoluteY)
+            return absolute(mode != Absolute);
+        return IdleAccess::Pure;
+    case InstructionGroup::Type2:
+        if (mode == Addr_Accumulator)
+            return IdleAccess::Pure;
+        if (op != LDX)
+            return IdleAccess::Unsafe;
+        if (mode == Addr_Absolute || mode == Addr_AbsoluteIndexed)
+            return absolute(mode != Addr_Absolute);
+        return IdleAccess::Pure;
+    case InstructionGroup::Type0:
+        if (op == STY)
+            return IdleAccess::Unsafe;
+        if (mode == Addr_Absolute || mode == Addr_AbsoluteIndexed)
+            return absolute(mode != Addr_Absolute);
+        return IdleAccess::Pure;
+    case InstructionGroup::Branch:
+    case InstructionGroup::Unknown:
+        break;
+    }
+    return IdleAccess::Unsafe;
+}
 
-    auto CycleLength = OperationCycles[opcode];
+std::unique_ptr<CPU::DecodedInstruction[]> CPU::decode_bank(const uint8_t *code)
+{
+    std::unique_ptr<DecodedInstruction[]> bank(new DecodedInstruction[0x2000]);
+    for (int offset = 0; offset < 0x2000; ++offset) {
+        uint8_t opcode = code[offset];
+        int length = instruction_length(opcode);
+        // The rest of the instruction lies in whichever bank is mapped next.
+        if (offset + length > 0x2000)
+            continue;
+
+        DecodedInstruction &decoded = bank[offset];
+        decoded.handler = decoded_handlers[opcode];
+        decoded.fused = fused_handler(code + offset, 0x2000 - offset);
+        decoded.length = length;
+        decoded.first_cycles = OperationCycles[opcode];
+        if (length > 1)
+            decoded.operand = code[offset + 1];
+        if (length > 2)
+            decoded.operand |= code[offset + 2] << 8;
+    }
 
-    if (CycleLength && (executeImplied(opcode) || executeBranch(opcode) || executeType1(opcode) || executeType2(opcode) || executeType0(opcode))) {
-        skipCycles += CycleLength;
-    } else {
-        printf("Unrecognized opcode: %02X\n", opcode);
+    // Idle loops: short backward branches over straight-line code that has no
+    // effect but to wait for RAM or PPUSTATUS to change, e.g. polling for
+    // vblank or for the NMI handler to set a flag. See Bus::skip_idle_loop().
+    constexpr int MaxIdleLoop = 32;
+    for (int offset = 0; offset + 2 <= 0x2000; ++offset) {
+        if (instruction_group(code[offset]) != InstructionGroup::Branch)
+            continue;
+        int head = offset + 2 + static_cast<int8_t>(code[offset + 1]);
+        if (head < 0 || head > offset || offset + 2 - head > MaxIdleLoop)
+            continue;
+
+        bool reads_status = false;
+        int at = head;
+        while (at < offset) {
+            IdleAccess access = idle_access(code + at);
+            if (access == IdleAccess::Unsafe)
+                break;
+            reads_status |= access == IdleAccess::Status;
+            at += instruction_length(code[at]);
+        }
+        if (at != offset)
+            continue;
+        bank[head].idle_loop = static_cast<uint8_t>(offset + 2 - head);
+        bank[head].idle_loop_reads_status = reads_status;
     }
+    return bank;
+}
+
+// Runs two decoded instructions back to back. The second one's entry follows
+// the first in the same bank.
+template<uint8_t First, uint8_t Second>
+void CPU::dispatch_pair(CPU &cpu)
+{
+    cpu.execute<First, true>();
+    const DecodedInstruction &second = cpu.decoded_entry[instruction_length(First)];
+    cpu.decoded_operand = second.operand;
+    cpu.regs.pc += instruction_length(Second);
+    cpu.execute<Second, true>();
+}
+
+// Superinstructions for the pairs that dominate typical game loops. The first
+// instruction of each has a fixed cycle count and touches nothing that could
+// raise an interrupt or start a DMA, so only the bus's own schedule decides
+// whether the second may follow straight on.
+CPU::Handler CPU::fused_handler(const uint8_t *code, int available)
+{
+    int first = instruction_length(code[0]);
+    if (first >= available || first + instruction_length(code[first]) > available)
+        return nullptr;
+
+    uint8_t opcode = code[0];
+    uint8_t next = code[first];
+    if (opcode == 0xa5 && next == 0x8d && (code[first + 1] | code[first + 2] << 8) < 0x2000)
+        return &dispatch_pair<0xa5, 0x8d>;  // LDA zp / STA abs (internal RAM)
+    if (opcode == 0xca && next == 0xd0)
+        return &dispatch_pair<0xca, 0xd0>;  // DEX / BNE
+    if (opcode == 0xad && next == 0x10)
+        return &dispatch_pair<0xad, 0x10>;  // LDA abs / BPL, e.g. polling $2002
+    if (opcode == 0xe6 && next == 0xa5)
+        return &dispatch_pair<0xe6, 0xa5>;  // INC zp / LDA zp
+    return nullptr;
 }
 
-bool CPU::executeImplied(uint8_t opcode)
+template<bool Decoded>
+uint8_t CPU::fetch_byte()
 {
-    switch (static_cast<OperationImplied>(opcode)) {
+    return Decoded ? static_cast<uint8_t>(decoded_operand) : this->bus.read(regs.pc++);
+}
+
+template<bool Decoded>
+uint16_t CPU::fetch_word()
+{
+    if (Decoded)
+        return decoded_operand;
+    uint16_t word = read_address(regs.pc);
+    regs.pc += 2;
+    return word;
+}
+
+template<CPU::Source From>
+uint8_t CPU::load(uint16_t location)
+{
+    if (From == Source::Value)
+        return static_cast<uint8_t>(location);
+    if (From == Source::ZeroPage)
+        return ram[location];
+    return this->bus.read(location);
+}
+
+template<CPU::Source From>
+void CPU::store(uint16_t location, uint8_t value)
+{
+    if (From == Source::ZeroPage)
+        ram[location] = value;
+    else
+        this->bus.write(location, value);
+}
+
+// One handler per opcode. Group, addressing mode and operation are all
+// compile-time constants here, so each instantiation reduces to the code for
+// exactly that instruction.
+template<uint8_t Opcode, bool Decoded>
+void CPU::execute()
+{
+    constexpr InstructionGroup group = instruction_group(Opcode);
+    constexpr auto mode = (Opcode & AddrModeMask) >> AddrModeShift;
+    constexpr auto op = (Opcode & OperationMask) >> OperationShift;
+    // Decoded immediates hand the operand value straight to the operation.
+    // Only loads, compares and arithmetic have an immediate mode.
+    constexpr bool value = Decoded && (group == InstructionGroup::Type1 ? mode == Immediate : mode == Addr_Immediate);
+    constexpr bool zero_page = group == InstructionGroup::Type1 ? (mode == ZeroPage || mode == IndexedX)
+                                                                : (mode == Addr_ZeroPage || mode == Addr_Indexed);
+    constexpr Source from = value ? Source::Value : zero_page ? Source::ZeroPage : Source::Memory;
+
+    switch (group) {
+    case InstructionGroup::Implied:
+        executeImplied<Opcode, Decoded>();
+        break;
+    case InstructionGroup::Branch:
+        executeBranch<Opcode, Decoded>();
+        break;
+    case InstructionGroup::Type1:
+        executeType1<static_cast<Operation1>(op), from>(addressType1<static_cast<AddrMode1>(mode), op == STA, Decoded>());
+        break;
+    case InstructionGroup::Type2:
+        executeType2<static_cast<Operation2>(op), mode == Addr_Accumulator, from>(
+            addressType2<static_cast<AddrMode2>(mode), op == LDX || op == STX, Decoded>());
+        break;
+    case InstructionGroup::Type0:
+        executeType0<static_cast<Operation0>(op), from>(addressType2<static_cast<AddrMode2>(mode), false, Decoded>());
+        break;
+    case InstructionGroup::Unknown:
+        printf("Unrecognized opcode: %02X\n", Opcode);
+        return;
+    }
+
+    skipCycles += OperationCycles[Opcode];
+}
+
+template<bool Decoded, size_t... Opcodes>
+constexpr std::array<CPU::Handler, 0x100> CPU::makeHandlers(std::index_sequence<Opcodes...>)
+{
+    return {{ &CPU::dispatch<static_cast<uint8_t>(Opcodes), Decoded>... }};
+}
+
+const std::array<CPU::Handler, 0x100> CPU::handlers = CPU::makeHandlers<false>(std::make_index_sequence<0x100>());
+const std::array<CPU::Handler, 0x100> CPU::decoded_handlers = CPU::makeHandlers<true>(std::make_index_sequence<0x100>());
+
+template<uint8_t Opcode, bool Decoded>
+void CPU::executeImplied()
+{
+    switch (static_cast<OperationImplied>(Opcode)) {
     case NOP:
         break;
     case BRK:
@@ -194,6 +596,13 @@ bool CPU::executeImplied(uint8_t opcode)
     case JSR:
         // Push address of next instruction - 1, thus r_PC + 1 instead of r_PC + 2
         // since r_PC and r_PC + 1 are address of subroutine
+        if (Decoded) {
+            // PC is already past the operand.
+            stack_push((regs.pc - 1) >> 8);
+            stack_push(regs.pc - 1);
+            regs.pc = decoded_operand;
+            break;
+        }
         stack_push((regs.pc + 1) >> 8);
         stack_push(regs.pc + 1);
         regs.pc = read_address(regs.pc);
@@ -204,15 +613,15 @@ bool CPU::executeImplied(uint8_t opcode)
         ++regs.pc;
         break;
     case RTI:
-        flags.all = stack_pop();
+        set_status(stack_pop());
         regs.pc = stack_pop();
         regs.pc |= stack_pop() << 8;
         break;
     case JMP:
-        regs.pc = read_address(regs.pc);
+        regs.pc = fetch_word<Decoded>();
         break;
     case JMPI: {
-        uint16_t location = read_address(regs.pc);
+        uint16_t location = fetch_word<Decoded>();
         // this emulates a 6502 bug where when the vector of an indirect address begins at the last byte of a page,
         // the second byte is fetched from the beginning of that page rather than the beginning of the next
         uint16_t page = location & 0xff00;
@@ -220,10 +629,10 @@ bool CPU::executeImplied(uint8_t opcode)
     }
     break;
     case PHP:
-        stack_push(flags.all);
+        stack_push(get_flags().all);
         break;
     case PLP:
-        flags.all = stack_pop();
+        set_status(stack_pop());
         break;
     case PHA:
         stack_push(regs.a);
@@ -253,10 +662,10 @@ bool CPU::executeImplied(uint8_t opcode)
         set_zn(regs.x);
         break;
     case CLC:
-        flags.C = 0;
+        carry = 0;
         break;
     case SEC:
-        flags.C = 1;
+        carry = 1;
         break;
     case CLI:
         flags.I = 0;
@@ -275,7 +684,7 @@ bool CPU::executeImplied(uint8_t opcode)
         set_zn(regs.a);
         break;
     case CLV:
-        flags.V = false;
+        overflow = 0;
         break;
     case TXA:
         regs.a = regs.x;
@@ -292,339 +701,278 @@ bool CPU::executeImplied(uint8_t opcode)
         regs.x = regs.sp;
         set_zn(regs.x);
         break;
-    default:
-        return false;
     };
-    return true;
 }
 
-bool CPU::executeBranch(uint8_t opcode)
+template<uint8_t Opcode, bool Decoded>
+void CPU::executeBranch()
 {
-    if ((opcode & BranchInstructionMask) == BranchInstructionMaskResult) {
-        // branch is initialized to the condition required (for the flag specified later)
-        bool branch = opcode & BranchConditionMask;
-
-        // set branch to true if the given condition is met by the given flag
-        // We use xnor here, it is true if either both operands are true or false
-        switch (opcode >> BranchOnFlagShift) {
-            case Negative:
-                branch = !(branch ^ flags.N);
-                break;
-            case Overflow:
-                branch = !(branch ^ flags.V);
-                break;
-            case Carry:
-                branch = !(branch ^ flags.C);
-                break;
-            case Zero:
-                branch = !(branch ^ flags.Z);
-                break;
-            default:
-                return false;
-        }
-
-        if (branch) {
-            int8_t offset = this->bus.read(regs.pc++);
-            // skip 1 cycle since branch is taken
-            ++skipCycles;
-            uint16_t newPC = (regs.pc + offset);
-            // skip 1 additional cycle if page is crossed
-            skipPageCrossCycle(regs.pc, newPC);
-            regs.pc = newPC;
-        } else
-            ++regs.pc;
-        return true;
+    // branch is initialized to the condition required (for the flag specified later)
+    bool branch = Opcode & BranchConditionMask;
+
+    // set branch to true if the given condition is met by the given flag
+    // We use xnor here, it is true if either both operands are true or false
+    switch (Opcode >> BranchOnFlagShift) {
+        case Negative:
+            branch = !(branch ^ ((negative_result & 0x80) != 0));
+            break;
+        case Overflow:
+            branch = !(branch ^ (overflow != 0));
+            break;
+        case Carry:
+            branch = !(branch ^ (carry != 0));
+            break;
+        case Zero:
+            branch = !(branch ^ (zero_result == 0));
+            break;
     }
-    return false;
+
+    if (branch) {
+        int8_t offset = fetch_byte<Decoded>();
+        // skip 1 cycle since branch is taken
+        ++skipCycles;
+        uint16_t newPC = (regs.pc + offset);
+        // skip 1 additional cycle if page is crossed
+        skipPageCrossCycle(regs.pc, newPC);
+        regs.pc = newPC;
+    } else if (!Decoded)
+        ++regs.pc;
 }
 
-bool CPU::executeType1(uint8_t opcode)
+// Stores never take the page-cross penalty.
+template<AddrMode1 Mode, bool Store, bool Decoded>
+uint16_t CPU::addressType1()
 {
-    if ((opcode & InstructionModeMask) == 0x1) {
-        uint16_t location = 0; // operand location
-        auto op = static_cast<Operation1>((opcode & OperationMask) >> OperationShift);
-        switch (static_cast<AddrMode1>((opcode & AddrModeMask) >> AddrModeShift)) {
-            case IndexedIndirectX: {
-                uint8_t zero_addr = regs.x + this->bus.read(regs.pc++);
-                // addresses wrap in zero page mode
-                location = this->bus.read(zero_addr & 0xff) | this->bus.read((zero_addr + 1) & 0xff) << 8;
-                break;
-            }
-            case ZeroPage:
-                location = this->bus.read(regs.pc++);
-                break;
-            case Immediate:
-                location = regs.pc++;
-                break;
-            case Absolute:
-                location = read_address(regs.pc);
-                regs.pc += 2;
-                break;
-            case IndirectY: {
-                uint8_t zero_addr = this->bus.read(regs.pc++);
-                location = this->bus.read(zero_addr & 0xff) | this->bus.read((zero_addr + 1) & 0xff) << 8;
-                if (op != STA)
-                    skipPageCrossCycle(location, location + regs.y);
-                location += regs.y;
-                break;
-            }
-
-            case IndexedX:
-                // Address wraps around in the zero page
-                location = (this->bus.read(regs.pc++) + regs.x) & 0xff;
-                break;
-            case AbsoluteY:
-                location  = read_address(regs.pc);
-                regs.pc += 2;
-                if (op != STA)
-                    skipPageCrossCycle(location, location + regs.y);
-                location += regs.y;
-                break;
-            case AbsoluteX:
-                location  = read_address(regs.pc);
-                regs.pc += 2;
-                if (op != STA)
-                    skipPageCrossCycle(location, location + regs.x);
-                location += regs.x;
-                break;
-            default:
-                return false;
+    uint16_t location = 0; // operand location
+    switch (Mode) {
+        case IndexedIndirectX: {
+            uint8_t zero_addr = regs.x + fetch_byte<Decoded>();
+            // addresses wrap in zero page mode
+            location = read_zero_page_address(zero_addr);
+            break;
         }
-
-        switch (op) {
-            case ORA:
-                regs.a |= this->bus.read(location);
-                set_zn(regs.a);
-                break;
-            case EOR:
-                regs.a ^= this->bus.read(location);
-                set_zn(regs.a);
-                break;
-            case AND:
-                regs.a &= this->bus.read(location);
-                set_zn(regs.a);
-                break;
-            case ADC: {
-                uint8_t operand = this->bus.read(location);
-                std::uint16_t sum = regs.a + operand + flags.C;
-                // Carry forward or UNSIGNED overflow
-                flags.C = (sum & 0x100) != 0;
-                // SIGNED overflow, would only happen if the sign of sum is
-                // different from BOTH the operands
-                flags.V = ((regs.a ^ sum) & (operand ^ sum) & 0x80) != 0;
-                regs.a = static_cast<uint8_t>(sum);
-                set_zn(regs.a);
-                break;
-            }
-            case STA:
-                this->bus.write(location, regs.a);
-                break;
-            case LDA:
-                regs.a = this->bus.read(location);
-                set_zn(regs.a);
-                break;
-            case SBC: {
-                // High carry means "no borrow", thus negate and subtract
-                std::uint16_t subtrahend = this->bus.read(location), diff = regs.a - subtrahend - !flags.C;
-                // if the ninth bit is 1, the resulting number is negative => borrow => low carry
-                flags.C = !(diff & 0x100);
-                // Same as ADC, except instead of the subtrahend,
-                // substitute with it's one complement
-                flags.V = ((regs.a ^ diff) & (~subtrahend ^ diff) & 0x80) != 0;
-                regs.a = diff;
-                set_zn(diff);
-                break;
-            }
-            case CMP: {
-                std::uint16_t diff = regs.a - this->bus.read(location);
-                flags.C = !(diff & 0x100);
-                set_zn(diff);
-                break;
-            }
-
-            default:
-                return false;
-            }
-            return true;
+        case ZeroPage:
+            location = fetch_byte<Decoded>();
+            break;
+        case Immediate:
+            location = Decoded ? fetch_byte<Decoded>() : regs.pc++;
+            break;
+        case Absolute:
+            location = fetch_word<Decoded>();
+            break;
+        case IndirectY: {
+            uint8_t zero_addr = fetch_byte<Decoded>();
+            location = read_zero_page_address(zero_addr);
+            if (!Store)
+                skipPageCrossCycle(location, location + regs.y);
+            location += regs.y;
+            break;
         }
-    return false;
+        case IndexedX:
+            // Address wraps around in the zero page
+            location = (fetch_byte<Decoded>() + regs.x) & 0xff;
+            break;
+        case AbsoluteY:
+            location = fetch_word<Decoded>();
+            if (!Store)
+                skipPageCrossCycle(location, location + regs.y);
+            location += regs.y;
+            break;
+        case AbsoluteX:
+            location = fetch_word<Decoded>();
+            if (!Store)
+                skipPageCrossCycle(location, location + regs.x);
+            location += regs.x;
+            break;
+    }
+    return location;
 }
 
-bool CPU::executeType2(uint8_t opcode)
+template<Operation1 Op, CPU::Source From>
+void CPU::executeType1(uint16_t location)
 {
-    if ((opcode & InstructionModeMask) == 2)
-    {
-        uint16_t location  = 0;
-        auto     op        = static_cast<Operation2>((opcode & OperationMask) >> OperationShift);
-        auto     addr_mode = static_cast<AddrMode2>((opcode & AddrModeMask) >> AddrModeShift);
-        switch (addr_mode) {
-            case Addr_Immediate:
-                location = regs.pc++;
-                break;
-            case Addr_ZeroPage:
-                location = this->bus.read(regs.pc++);
-                break;
-            case Addr_Accumulator:
-                break;
-            case Addr_Absolute:
-                location  = read_address(regs.pc);
-                regs.pc += 2;
-                break;
-            case Addr_Indexed: {
-                location = this->bus.read(regs.pc++);
-                uint8_t index;
-                if (op == LDX || op == STX)
-                    index = regs.y;
-                else
-                    index = regs.x;
-                // zp wrapping
-                location = (location + index) & 0xff;
-                break;
-            }
-            case Addr_AbsoluteIndexed: {
-                location  = read_address(regs.pc);
-                regs.pc += 2;
-                uint8_t index;
-                if (op == LDX || op == STX)
-                    index = regs.y;
-                else
-                    index = regs.x;
-                skipPageCrossCycle(location, location + index);
-                location += index;
-                break;
-            }
-
-            default:
-                return false;
+    switch (Op) {
+        case ORA:
+            regs.a |= load<From>(location);
+            set_zn(regs.a);
+            break;
+        case EOR:
+            regs.a ^= load<From>(location);
+            set_zn(regs.a);
+            break;
+        case AND:
+            regs.a &= load<From>(location);
+            set_zn(regs.a);
+            break;
+        case ADC: {
+            uint8_t operand = load<From>(location);
+            std::uint16_t sum = regs.a + operand + carry;
+            // Carry forward or UNSIGNED overflow
+            carry = (sum & 0x100) != 0;
+            // SIGNED overflow, would only happen if the sign of sum is
+            // different from BOTH the operands
+            overflow = ((regs.a ^ sum) & (operand ^ sum) & 0x80) != 0;
+            regs.a = static_cast<uint8_t>(sum);
+            set_zn(regs.a);
+            break;
         }
-
-        std::uint16_t operand = 0;
-        switch (op) {
-        case ASL:
-        case ROL: {
-            if (addr_mode == Addr_Accumulator) {
-                auto prev_C = flags.C;
-                flags.C = (regs.a & 0x80) != 0;
-                regs.a <<= 1;
-                // If Rotating, set the bit-0 to the the previous carry
-                regs.a |= prev_C && (op == ROL);
-                set_zn(regs.a);
-            } else {
-                auto prev_C = flags.C;
-                operand = this->bus.read(location);
-                flags.C = (operand & 0x80) != 0;
-                operand = operand << 1 | (prev_C && (op == ROL));
-                set_zn(operand);
-                this->bus.write(location, operand);
-            }
+        case STA:
+            store<From>(location, regs.a);
+            break;
+        case LDA:
+            regs.a = load<From>(location);
+            set_zn(regs.a);
+            break;
+        case SBC: {
+            // High carry means "no borrow", thus negate and subtract
+            std::uint16_t subtrahend = load<From>(location), diff = regs.a - subtrahend - !carry;
+            // if the ninth bit is 1, the resulting number is negative => borrow => low carry
+            carry = !(diff & 0x100);
+            // Same as ADC, except instead of the subtrahend,
+            // substitute with it's one complement
+            overflow = ((regs.a ^ diff) & (~subtrahend ^ diff) & 0x80) != 0;
+            regs.a = diff;
+            set_zn(diff);
             break;
         }
-        case LSR:
-        case ROR: {
-            if (addr_mode == Addr_Accumulator) {
-                auto prev_C = flags.C;
-                flags.C = (regs.a & 1) != 0;
-                regs.a >>= 1;
-                // If Rotating, set the bit-7 to the previous carry
-                regs.a = regs.a | (prev_C && (op == ROR)) << 7;
-                set_zn(regs.a);
-            } else {
-                auto prev_C = flags.C;
-                operand = this->bus.read(location);
-                flags.C = (operand & 1) != 0;
-                operand = operand >> 1 | (prev_C && (op == ROR)) << 7;
-                set_zn(operand);
-                this->bus.write(location, operand);
-            }
+        case CMP: {
+            std::uint16_t diff = regs.a - load<From>(location);
+            carry = !(diff & 0x100);
+            set_zn(diff);
             break;
         }
-        case STX:
-            this->bus.write(location, regs.x);
+    }
+}
+
+// Addressing for type 2 and type 0 instructions. LDX/STX index with Y instead of X.
+template<AddrMode2 Mode, bool IndexY, bool Decoded>
+uint16_t CPU::addressType2()
+{
+    uint16_t location = 0;
+    switch (Mode) {
+        case Addr_Immediate:
+            location = Decoded ? fetch_byte<Decoded>() : regs.pc++;
             break;
-        case LDX:
-            regs.x = this->bus.read(location);
-            set_zn(regs.x);
+        case Addr_ZeroPage:
+            location = fetch_byte<Decoded>();
             break;
-        case DEC: {
-            auto loc = this->bus.read(location) - 1;
-            set_zn(loc);
-            this->bus.write(location, loc);
+        case Addr_Accumulator:
             break;
-        }
-        case INC: {
-            auto loc = this->bus.read(location) + 1;
-            set_zn(loc);
-            this->bus.write(location, loc);
+        case Addr_Absolute:
+            location = fetch_word<Decoded>();
+            break;
+        case Addr_Indexed: {
+            location = fetch_byte<Decoded>();
+            uint8_t index = IndexY ? regs.y : regs.x;
+            // zp wrapping
+            location = (location + index) & 0xff;
             break;
         }
-        default:
-            return false;
+        case Addr_AbsoluteIndexed: {
+            location = fetch_word<Decoded>();
+            uint8_t index = IndexY ? regs.y : regs.x;
+            skipPageCrossCycle(location, location + index);
+            location += index;
+            break;
         }
-        return true;
     }
-    return false;
+    return location;
 }
 
-bool CPU::executeType0(uint8_t opcode)
+template<Operation2 Op, bool Accumulator, CPU::Source From>
+void CPU::executeType2(uint16_t location)
 {
-    if ((opcode & InstructionModeMask) == 0x0) {
-        uint16_t location = 0;
-        switch (static_cast<AddrMode2>((opcode & AddrModeMask) >> AddrModeShift)) {
-            case Addr_Immediate:
-                location = regs.pc++;
-                break;
-            case Addr_ZeroPage:
-                location = this->bus.read(regs.pc++);
-                break;
-            case Addr_Absolute:
-                location = read_address(regs.pc);
-                regs.pc += 2;
-                break;
-            case Addr_Indexed:
-                // more zp wrapping
-                location = (this->bus.read(regs.pc++) + regs.x) & 0xff;
-                break;
-            case Addr_AbsoluteIndexed:
-                location = read_address(regs.pc);
-                regs.pc += 2;
-                skipPageCrossCycle(location, location + regs.x);
-                location += regs.x;
-                break;
-            default:
-                return false;
+    std::uint16_t operand = 0;
+    switch (Op) {
+    case ASL:
+    case ROL: {
+        if (Accumulator) {
+            uint8_t prev_C = carry;
+            carry = (regs.a & 0x80) != 0;
+            regs.a <<= 1;
+            // If Rotating, set the bit-0 to the the previous carry
+            regs.a |= prev_C && (Op == ROL);
+            set_zn(regs.a);
+        } else {
+            uint8_t prev_C = carry;
+            operand = load<From>(location);
+            carry = (operand & 0x80) != 0;
+            operand = operand << 1 | (prev_C && (Op == ROL));
+            set_zn(operand);
+            store<From>(location, operand);
         }
-        std::uint16_t operand = 0;
-        switch (((opcode & OperationMask) >> OperationShift)) {
-            case BIT:
-                operand = this->bus.read(location);
-                flags.Z = !(regs.a & operand);
-                flags.V = (operand & 0x40) != 0;
-                flags.N = (operand & 0x80) != 0;
-                break;
-            case STY:
-                this->bus.write(location, regs.y);
-                break;
-            case LDY:
-                regs.y = this->bus.read(location);
-                set_zn(regs.y);
-                break;
-            case CPX: {
-                std::uint16_t diff = regs.x - this->bus.read(location);
-                flags.C = !(diff & 0x100);
-                set_zn(diff);
-                break;
-            }
-            case CPY: {
-                std::uint16_t diff = regs.y - this->bus.read(location);
-                flags.C = !(diff & 0x100);
-                set_zn(diff);
-                break;
-            }
-            default:
-                return false;
+        break;
+    }
+    case LSR:
+    case ROR: {
+        if (Accumulator) {
+            uint8_t prev_C = carry;
+            carry = (regs.a & 1) != 0;
+            regs.a >>= 1;
+            // If Rotating, set the bit-7 to the previous carry
+            regs.a = regs.a | (prev_C && (Op == ROR)) << 7;
+            set_zn(regs.a);
+        } else {
+            uint8_t prev_C = carry;
+            operand = load<From>(location);
+            carry = (operand & 1) != 0;
+            operand = operand >> 1 | (prev_C && (Op == ROR)) << 7;
+            set_zn(operand);
+            store<From>(location, operand);
         }
+        break;
+    }
+    case STX:
+        store<From>(location, regs.x);
+        break;
+    case LDX:
+        regs.x = load<From>(location);
+        set_zn(regs.x);
+        break;
+    case DEC: {
+        auto loc = load<From>(location) - 1;
+        set_zn(loc);
+        store<From>(location, loc);
+        break;
+    }
+    case INC: {
+        auto loc = load<From>(location) + 1;
+        set_zn(loc);
+        store<From>(location, loc);
+        break;
+    }
+    }
+}
 
-        return true;
+template<Operation0 Op, CPU::Source From>
+void CPU::executeType0(uint16_t location)
+{
+    std::uint16_t operand = 0;
+    switch (Op) {
+        case BIT:
+            operand = load<From>(location);
+            zero_result = regs.a & operand;
+            overflow = (operand & 0x40) != 0;
+            negative_result = operand;
+            break;
+        case STY:
+            store<From>(location, regs.y);
+            break;
+        case LDY:
+            regs.y = load<From>(location);
+            set_zn(regs.y);
+            break;
+        case CPX: {
+            std::uint16_t diff = regs.x - load<From>(location);
+            carry = !(diff & 0x100);
+            set_zn(diff);
+            break;
+        }
+        case CPY: {
+            std::uint16_t diff = regs.y - load<From>(location);
+            carry = !(diff & 0x100);
+            set_zn(diff);
+            break;
+        }
     }
-    return false;
 }
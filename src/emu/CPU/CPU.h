@@ -1,13 +1,21 @@
 #pragma once
 #include "opcodes.h"
+#include "compiled_block.h"
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <list>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "../irq.h"
 
 class Bus;
 class IRQ;
 class CPU;
+class JitX64;
+class AotModule;
 
 union CPUFlags {
     struct {
@@ -35,9 +43,30 @@ struct CPURegisters {
 class CPU {
 public:
     CPU(Bus &mem);
+    ~CPU();
 
     void clock();
     void reset();
+
+    // Instruction-granular execution. ready() is true on the cycle the next
+    // instruction (or interrupt) starts; step() executes it on that cycle and
+    // returns its length in cycles. The remaining length - 1 cycles are then
+    // counted off with idle_cycles(). step() + idle_cycles() is equivalent to
+    // the same number of clock() calls.
+    //
+    // budget is how many more cycles may pass before anything scheduled on
+    // the bus falls due. A compiled block (BusOptions::aot, BusOptions::jit)
+    // keeps starting instructions within it; the interpreter runs one
+    // instruction anyway, plus the following one if the pair has a
+    // superinstruction (BusOptions::superinstructions) and the first ends
+    // within the budget. The combined length is returned.
+    bool ready() const { return skipCycles <= 1; }
+    int step(int budget = 0);
+    void idle_cycles(int count = 1) { cycles += count; skipCycles -= count; }
+    // Counts off cycles spent waiting at an instruction boundary (see
+    // Bus::skip_idle_loop()).
+    void wait_cycles(int count) { cycles += count; }
+
     void reset(uint16_t start_addr);
     void log();
 
@@ -52,38 +81,130 @@ public:
 
     void load_state(const CPURegisters &regs, const CPUFlags &flags) {
         this->regs = regs;
-        this->flags = flags;
+        set_status(flags.all);
     };
 
 
-    CPUFlags get_flags() const { return flags; }
+    // Copies every register, flag and pending interrupt from another CPU.
+    // IRQ handlers stay attached to this CPU.
+    void copy_state(const CPU &other);
+
+    // Reads a little-endian word through the bus, e.g. an interrupt vector.
+    uint16_t read_address(uint16_t addr);
+
+    CPUFlags get_flags() const;
     CPURegisters get_regs() const;
     int getCycleCount() const { return cycles; }
 
+    // The idle loop starting at addr (see DecodedInstruction::idle_loop): its
+    // length in bytes, or 0 if there is none or the code isn't in the decode
+    // cache. reads_status tells whether the loop polls PPUSTATUS.
+    int idle_loop_at(uint16_t addr, bool &reads_status) const;
+
 private:
     void interruptSequence(InterruptType type);
 
-    // Instructions are split into five sets to make decoding easier.
-    // These functions return true if they succeed
-    bool executeImplied(uint8_t opcode);
-    bool executeBranch(uint8_t opcode);
-    bool executeType0(uint8_t opcode);
-    bool executeType1(uint8_t opcode);
-    bool executeType2(uint8_t opcode);
+    // Opcode dispatch: a 256-entry table, built at compile time, of handlers
+    // specialised for each opcode's addressing mode and operation. The
+    // Decoded variants take their operand from the decode cache below
+    // instead of fetching it through the bus.
+    using Handler = void (*)(CPU&);
+    static const std::array<Handler, 0x100> handlers;
+    static const std::array<Handler, 0x100> decoded_handlers;
+
+    template<bool Decoded, size_t... Opcodes>
+    static constexpr std::array<Handler, 0x100> makeHandlers(std::index_sequence<Opcodes...>);
+    template<uint8_t Opcode, bool Decoded>
+    static void dispatch(CPU &cpu) { cpu.execute<Opcode, Decoded>(); }
+    template<uint8_t First, uint8_t Second>
+    static void dispatch_pair(CPU &cpu);
+    static Handler fused_handler(const uint8_t *code, int available);
+    template<uint8_t Opcode, bool Decoded>
+    void execute();
+
+    // Where the location passed to an operation points: an address on the
+    // bus, the operand itself (a decoded immediate), or a zero page address,
+    // which is always internal RAM and so read and written directly.
+    enum class Source { Memory, Value, ZeroPage };
 
-    uint16_t read_address(uint16_t addr);
+    // Instructions are split into five sets to make decoding easier.
+    template<uint8_t Opcode, bool Decoded> void executeImplied();
+    template<uint8_t Opcode, bool Decoded> void executeBranch();
+    template<AddrMode1 Mode, bool Store, bool Decoded> uint16_t addressType1();
+    template<Operation1 Op, Source From> void executeType1(uint16_t location);
+    template<AddrMode2 Mode, bool IndexY, bool Decoded> uint16_t addressType2();
+    template<Operation2 Op, bool Accumulator, Source From> void executeType2(uint16_t location);
+    template<Operation0 Op, Source From> void executeType0(uint16_t location);
+
+    template<bool Decoded> uint8_t fetch_byte();
+    template<bool Decoded> uint16_t fetch_word();
+    template<Source From> uint8_t load(uint16_t location);
+    template<Source From> void store(uint16_t location, uint8_t value);
+    uint16_t read_zero_page_address(uint8_t addr) const { return ram[addr] | ram[(addr + 1) & 0xff] << 8; }
+
+    // Decode cache for code running from PRG ROM. Each 8KB ROM bank is decoded
+    // the first time it is mapped, one entry per byte offset, and prg_windows
+    // points $8000-$FFFF at those tables. The windows are rebuilt whenever the
+    // mapper reports a PRG banking change. Code in RAM or PRG RAM is never
+    // cached, so writes need no invalidation.
+    struct DecodedInstruction {
+        Handler handler = nullptr;  // nullptr: operand runs past the bank, use the bus
+        // Superinstruction: this instruction and the next run as one handler.
+        // Only used when nothing can happen between them; first_cycles is how
+        // long this one takes.
+        Handler fused = nullptr;
+        uint16_t operand = 0;
+        uint8_t length = 0;
+        uint8_t first_cycles = 0;
+        // Length in bytes of the idle loop starting here, 0 if none: straight-
+        // line code ending in a branch back to this instruction, which writes
+        // nothing and reads only registers, internal RAM and (if
+        // idle_loop_reads_status) PPUSTATUS.
+        uint8_t idle_loop = 0;
+        bool idle_loop_reads_status = false;
+    };
+    void map_prg_windows();
+    static std::unique_ptr<DecodedInstruction[]> decode_bank(const uint8_t *code);
+
+    std::vector<std::unique_ptr<DecodedInstruction[]>> decoded_banks;
+    const DecodedInstruction *prg_windows[4] = {};
+    uint32_t prg_window_banks[4] = {};
+    uint32_t prg_windows_version = UINT32_MAX;
+    const DecodedInstruction *decoded_entry = nullptr;
+    uint16_t decoded_operand = 0;
+
+    // Compiled PRG ROM code: blocks from the shared AOT module
+    // (BusOptions::aot) first, then this console's JIT (BusOptions::jit).
+    // run_compiled() runs the block at pc if there is one.
+    const AotModule *aot = nullptr;
+    std::unique_ptr<JitX64> jit;
+    BlockState block_state{};
+    bool run_compiled(int budget);
+
+    // The console's internal RAM. Nothing else can be mapped at $0000-$01FF,
+    // so zero page and stack accesses skip the bus.
+    uint8_t *ram;
 
     void stack_push(uint8_t value);
     uint8_t stack_pop();
 
     void skipPageCrossCycle(uint16_t a, uint16_t b);
-    void set_zn(uint8_t value);
-
-    int skipCycles;
-    int cycles;
-
-    CPURegisters regs;
-    CPUFlags flags;
+    void set_zn(uint8_t value) { zero_result = negative_result = value; }
+    void set_status(uint8_t status);
+
+    int skipCycles = 0;
+    int cycles = 0;
+
+    CPURegisters regs{};
+    // I, D and B live in flags. The others are kept lazily, since nearly
+    // every instruction sets them and few read them: Z and N as the bytes
+    // they were last computed from, C and V as plain 0/1 bytes. The C, Z, V
+    // and N bits of flags are stale; get_flags() fills them in.
+    CPUFlags flags{};
+    uint8_t carry = 0;
+    uint8_t overflow = 0;
+    uint8_t zero_result = 1;
+    uint8_t negative_result = 0;
 
 public:
     bool pendingNMI;
@@ -0,0 +1,79 @@
+#include "aot_module.h"
+#include "../cartridge/rom_image.h"
+
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+bool AotModule::supported()
+{
+#ifndef _WIN32
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::shared_ptr<const AotModule> AotModule::load(const std::string &path)
+{
+#ifndef _WIN32
+    std::shared_ptr<AotModule> module(new AotModule());
+    module->handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!module->handle)
+        throw std::runtime_error("Failed to load AOT module " + path + ": " + dlerror());
+
+    auto entry = reinterpret_cast<const AotModuleInfo *(*)()>(dlsym(module->handle, "nestastic_aot_module"));
+    if (!entry)
+        throw std::runtime_error(path + " is not an AOT module");
+    const AotModuleInfo *info = entry();
+    if (!info || info->abi_version != AotAbiVersion)
+        throw std::runtime_error(path + " was generated for another version of nestastic");
+    module->info = info;
+
+    module->tables.resize((info->prg_size / 0x2000) * 4);
+    for (uint32_t i = 0; i < info->block_count; ++i) {
+        const AotBlock &block = info->blocks[i];
+        size_t table = block.bank * 4 + block.window;
+        if (block.window >= 4 || block.offset >= 0x2000 || table >= module->tables.size())
+            throw std::runtime_error(path + " has a block outside PRG ROM");
+        if (!module->tables[table])
+            module->tables[table].reset(new CompiledBlock[0x2000]());
+        module->tables[table][block.offset] = block.block;
+    }
+    return module;
+#else
+    throw std::runtime_error("AOT modules need a POSIX host: " + path);
+#endif
+}
+
+AotModule::~AotModule()
+{
+#ifndef _WIN32
+    if (handle)
+        dlclose(handle);
+#endif
+}
+
+// FNV-1a.
+uint64_t AotModule::prg_hash(const uint8_t *prg, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= prg[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool AotModule::matches(const std::shared_ptr<const RomImage> &rom) const
+{
+    std::lock_guard<std::mutex> lock(matched_mutex);
+    if (matched.lock() == rom)
+        return true;
+    if (rom->prg_size() != info->prg_size || prg_hash(rom->prg(), rom->prg_size()) != info->prg_hash)
+        return false;
+    matched = rom;
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "compiled_block.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class RomImage;
+
+// PRG ROM code compiled ahead of time (BusOptions::aot): a shared library
+// built from the C++ that nestastic_aot generates for one ROM. It has a block
+// for every entry point reachable from the reset, NMI and IRQ vectors, in the
+// banks the generator could tell would be mapped there; the CPU runs those
+// and interprets everything else. Blocks follow the same rules as JitX64's.
+//
+// Immutable once loaded, so any number of consoles running the ROM can share
+// one. Only available on POSIX hosts.
+class AotModule {
+public:
+    static bool supported();
+
+    // Throws if the library can't be loaded or was generated for another
+    // version of the core.
+    static std::shared_ptr<const AotModule> load(const std::string &path);
+    ~AotModule();
+
+    AotModule(const AotModule&) = delete;
+    AotModule& operator=(const AotModule&) = delete;
+
+    // What a module records of the PRG ROM it was generated from.
+    static uint64_t prg_hash(const uint8_t *prg, size_t size);
+    // Whether the module was generated from this ROM.
+    bool matches(const std::shared_ptr<const RomImage> &rom) const;
+
+    // The block starting at `offset` in PRG ROM bank `bank` while that bank
+    // is mapped at window `window`, or nullptr if the module has none.
+    CompiledBlock block(uint32_t bank, int window, uint16_t offset) const
+    {
+        size_t table = bank * 4 + window;
+        return table < tables.size() && tables[table] ? tables[table][offset] : nullptr;
+    }
+    size_t block_count() const { return info->block_count; }
+
+private:
+    AotModule() = default;
+
+    void *handle = nullptr;
+    const AotModuleInfo *info = nullptr;
+    // Blocks by bank * 4 + window, then offset; empty where there are none.
+    std::vector<std::unique_ptr<CompiledBlock[]>> tables;
+
+    // The last ROM matches() accepted, so consoles cloned from one another
+    // don't hash PRG ROM again.
+    mutable std::mutex matched_mutex;
+    mutable std::weak_ptr<const RomImage> matched;
+};
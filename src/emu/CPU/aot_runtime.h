@@ -0,0 +1,146 @@
+#pragma once
+#include "compiled_block.h"
+
+// What the C++ generated by nestastic_aot is written in terms of; nothing in
+// the core includes this. A block copies the registers out of the BlockState
+// into Regs, which never has its address taken, so the host compiler keeps
+// them in host registers until the block leaves. The helpers keep to
+// CPU.cpp's semantics the same way JitX64's block compiler does.
+namespace aot {
+
+struct Regs {
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t carry;
+    uint8_t overflow;
+    uint8_t zero_result;
+    uint8_t negative_result;
+    uint8_t flags;
+    int32_t cycles;
+    int32_t budget;
+    uint8_t *ram;
+};
+
+inline Regs enter(const BlockState *s)
+{
+    return Regs{s->a, s->x, s->y, s->sp, s->carry, s->overflow, s->zero_result, s->negative_result, s->flags,
+                0, s->budget, s->ram};
+}
+
+inline void leave(BlockState *s, const Regs &r, uint16_t pc)
+{
+    s->a = r.a;
+    s->x = r.x;
+    s->y = r.y;
+    s->sp = r.sp;
+    s->carry = r.carry;
+    s->overflow = r.overflow;
+    s->zero_result = r.zero_result;
+    s->negative_result = r.negative_result;
+    s->flags = r.flags;
+    s->pc = pc;
+    s->cycles = r.cycles;
+}
+
+inline void set_zn(Regs &r, uint8_t value)
+{
+    r.zero_result = value;
+    r.negative_result = value;
+}
+
+// get_flags(): I, D, B and U from flags, the others from the lazy flags.
+inline uint8_t status(const Regs &r)
+{
+    return static_cast<uint8_t>((r.flags & 0x3c) | r.carry | (r.zero_result == 0) << 1 | r.overflow << 6 |
+                                (r.negative_result & 0x80));
+}
+
+// As CPU::set_status() does.
+inline void set_status(Regs &r, uint8_t value)
+{
+    r.flags = value;
+    r.carry = value & 1;
+    r.overflow = (value >> 6) & 1;
+    r.zero_result = (value & 2) ? 0 : 1;
+    r.negative_result = value & 0x80;
+}
+
+inline void push(Regs &r, uint8_t value)
+{
+    r.ram[0x100 + r.sp] = value;
+    --r.sp;
+}
+
+inline uint8_t pop(Regs &r)
+{
+    ++r.sp;
+    return r.ram[0x100 + r.sp];
+}
+
+// a + value + carry, setting C, V, Z and N. SBC passes the operand's
+// complement.
+inline void add_with_carry(Regs &r, uint8_t value)
+{
+    unsigned sum = r.a + value + r.carry;
+    r.overflow = ((r.a ^ sum) & (value ^ sum) & 0x80) >> 7;
+    r.carry = static_cast<uint8_t>(sum >> 8);
+    r.a = static_cast<uint8_t>(sum);
+    set_zn(r, r.a);
+}
+
+// CMP, CPX and CPY.
+inline void compare(Regs &r, uint8_t reg, uint8_t value)
+{
+    r.carry = reg >= value;
+    set_zn(r, static_cast<uint8_t>(reg - value));
+}
+
+// Fixed-address accesses beyond internal RAM. Cartridge memory goes through
+// the bus's page tables where they map it.
+inline uint8_t read_io(BlockState *s, uint16_t addr)
+{
+    return static_cast<uint8_t>(s->read(s, addr));
+}
+
+inline uint8_t read_cart(BlockState *s, uint16_t addr)
+{
+    if (const uint8_t *page = s->read_pages[addr >> 8])
+        return page[addr & 0xff];
+    return static_cast<uint8_t>(s->read_cart(s, addr));
+}
+
+inline void write_io(BlockState *s, uint16_t addr, uint8_t value)
+{
+    s->write(s, addr, value);
+}
+
+inline void write_cart(BlockState *s, uint16_t addr, uint8_t value)
+{
+    if (uint8_t *page = s->write_pages[addr >> 8])
+        page[addr & 0xff] = value;
+    else
+        s->write_cart(s, addr, value);
+}
+
+// Accesses that may land anywhere; only the first instruction of a block
+// makes them.
+inline uint8_t read(BlockState *s, Regs &r, uint16_t addr)
+{
+    if (addr < 0x2000)
+        return r.ram[addr & 0x7ff];
+    return addr >= 0x4020 ? read_cart(s, addr) : read_io(s, addr);
+}
+
+inline void write(BlockState *s, Regs &r, uint16_t addr, uint8_t value)
+{
+    if (addr < 0x2000)
+        r.ram[addr & 0x7ff] = value;
+    else if (addr >= 0x4020 && addr < 0x8000)
+        write_cart(s, addr, value);
+    else
+        write_io(s, addr, value);
+}
+
+} // namespace aot
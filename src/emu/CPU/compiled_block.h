@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+
+class Bus;
+
+// What compiled PRG ROM code sees of the CPU, whether it was compiled at run
+// time (JitX64) or ahead of time (AotModule). The registers are copied in and
+// out around each block; C, V, N and Z are kept apart from the flags byte as
+// the interpreter keeps them (see CPU::get_flags()).
+struct BlockState {
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t carry;
+    uint8_t overflow;
+    uint8_t zero_result;
+    uint8_t negative_result;
+    uint8_t flags;
+    // Set when an access had side effects the caller has to see.
+    uint8_t io;
+    // Scratch space for read-modify-write instructions.
+    uint8_t scratch[2];
+    // Where the block left off, and the cycles it ran.
+    uint16_t pc;
+    int32_t cycles;
+    // A further instruction may start only while cycles <= budget (see
+    // CPU::step()).
+    int32_t budget;
+    uint8_t *ram;
+    // The bus's page tables (Bus::get_read_pages()), for cartridge accesses
+    // that need no call into the bus.
+    const uint8_t *const *read_pages;
+    uint8_t *const *write_pages;
+    Bus *bus;
+
+    // The bus beyond internal RAM. read() and write() are for PPU, APU, I/O
+    // and mapper registers, and set io. read_cart() is for $4020-$FFFF pages
+    // the page tables leave out, which have no side effects either;
+    // write_cart() is for PRG RAM, and sets io only if the mapper switched
+    // PRG banks.
+    uint32_t (*read)(BlockState *state, uint32_t addr);
+    void (*write)(BlockState *state, uint32_t addr, uint32_t value);
+    uint32_t (*read_cart)(BlockState *state, uint32_t addr);
+    void (*write_cart)(BlockState *state, uint32_t addr, uint32_t value);
+};
+
+using CompiledBlock = void (*)(BlockState *state);
+
+// PPU, APU and I/O registers.
+inline bool is_io(uint16_t addr)
+{
+    return addr >= 0x2000 && addr < 0x4020;
+}
+
+// Mapper registers and the above: only the first instruction of a block may
+// write them.
+inline bool is_io_write(uint16_t addr)
+{
+    return is_io(addr) || addr >= 0x8000;
+}
+
+// What a module generated by nestastic_aot exports, through
+// nestastic_aot_module(). AotAbiVersion changes whenever BlockState or the
+// generated code's expectations of the core do.
+constexpr uint32_t AotAbiVersion = 2;
+
+// The block for `offset` in PRG ROM bank `bank` mapped at window `window`.
+struct AotBlock {
+    uint32_t bank;
+    uint16_t window;
+    uint16_t offset;
+    CompiledBlock block;
+};
+
+struct AotModuleInfo {
+    uint32_t abi_version;
+    // The PRG ROM the module was generated from (see AotModule::prg_hash()).
+    uint32_t prg_size;
+    uint64_t prg_hash;
+    uint32_t block_count;
+    const AotBlock *blocks;
+};
+
+extern "C" const AotModuleInfo *nestastic_aot_module();
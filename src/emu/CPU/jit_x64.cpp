@@ -0,0 +1,1070 @@
+#include "jit_x64.h"
+#include "opcodes.h"
+
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <stdexcept>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define JIT_X64_SUPPORTED 1
+#else
+#define JIT_X64_SUPPORTED 0
+#endif
+
+namespace {
+
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum Cond { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_G = 0xf };
+enum Alu { Add, Or, Adc, Sbb, And, Sub, Xor, Cmp };
+
+// [base + index * scale + disp]; index < 0 for none.
+struct Mem {
+    int base;
+    int index;
+    int scale;
+    int32_t disp;
+};
+
+// Just enough of an x86-64 assembler for the block compiler: 32-bit ALU
+// operations, byte loads and stores, and forward jumps to labels.
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t value) { code.push_back(value); }
+    void word(uint16_t value) { byte(value); byte(value >> 8); }
+    void dword(uint32_t value) { word(value); word(value >> 16); }
+    void qword(uint64_t value) { dword(value); dword(value >> 32); }
+
+    // An opcode with a ModRM operand. byte_reg forces a REX prefix so that
+    // registers 4-7 mean spl-dil rather than ah-bh.
+    void op(std::initializer_list<uint8_t> opcode, int reg, const Mem &mem, bool wide = false, bool byte_reg = false)
+    {
+        int index = mem.index < 0 ? 0 : mem.index;
+        rex(wide, reg, index, mem.base, byte_reg && reg >= 4);
+        for (uint8_t b : opcode)
+            byte(b);
+
+        int mod = mem.disp == 0 && (mem.base & 7) != RBP ? 0 : (mem.disp >= -128 && mem.disp <= 127 ? 1 : 2);
+        if (mem.index < 0 && (mem.base & 7) != RSP) {
+            byte(mod << 6 | (reg & 7) << 3 | (mem.base & 7));
+        } else {
+            int scale = mem.scale == 8 ? 3 : mem.scale == 4 ? 2 : mem.scale == 2 ? 1 : 0;
+            byte(mod << 6 | (reg & 7) << 3 | 4);
+            byte(scale << 6 | ((mem.index < 0 ? RSP : mem.index) & 7) << 3 | (mem.base & 7));
+        }
+        if (mod == 1)
+            byte(static_cast<uint8_t>(mem.disp));
+        else if (mod == 2)
+            dword(static_cast<uint32_t>(mem.disp));
+    }
+    void op(std::initializer_list<uint8_t> opcode, int reg, int rm, bool wide = false, bool byte_rm = false)
+    {
+        rex(wide, reg, 0, rm, byte_rm && rm >= 4);
+        for (uint8_t b : opcode)
+            byte(b);
+        byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    void movzx8(int reg, const Mem &mem) { op({0x0f, 0xb6}, reg, mem); }
+    void movzx8(int reg, int rm) { op({0x0f, 0xb6}, reg, rm, false, true); }
+    void store8(const Mem &mem, int reg) { op({0x88}, reg, mem, false, true); }
+    void store8(const Mem &mem, uint8_t value) { op({0xc6}, 0, mem); byte(value); }
+    void store16(const Mem &mem, int reg) { byte(0x66); op({0x89}, reg, mem); }
+    void store16(const Mem &mem, uint16_t value) { byte(0x66); op({0xc7}, 0, mem); word(value); }
+    void store32(const Mem &mem, int reg) { op({0x89}, reg, mem); }
+    void load64(int reg, const Mem &mem) { op({0x8b}, reg, mem, true); }
+    void mov(int dst, int src) { op({0x89}, src, dst); }
+    void mov64(int dst, int src) { op({0x89}, src, dst, true); }
+    void mov(int dst, uint32_t value)
+    {
+        rex(false, 0, 0, dst, false);
+        byte(0xb8 | (dst & 7));
+        dword(value);
+    }
+    void mov64(int dst, uint64_t value)
+    {
+        rex(true, 0, 0, dst, false);
+        byte(0xb8 | (dst & 7));
+        qword(value);
+    }
+    void alu(Alu kind, int dst, int src) { op({static_cast<uint8_t>(kind << 3 | 1)}, src, dst); }
+    void alu(Alu kind, int dst, uint32_t value) { op({0x81}, kind, dst); dword(value); }
+    void alu(Alu kind, int reg, const Mem &mem) { op({static_cast<uint8_t>(kind << 3 | 3)}, reg, mem); }
+    void shl(int reg, uint8_t count) { op({0xc1}, 4, reg); byte(count); }
+    void shr(int reg, uint8_t count) { op({0xc1}, 5, reg); byte(count); }
+    void test(int a, int b) { op({0x85}, b, a); }
+    void test64(int a, int b) { op({0x85}, b, a, true); }
+    void setcc(Cond cond, int reg) { op({0x0f, static_cast<uint8_t>(0x90 | cond)}, 0, reg, false, true); }
+    void push(int reg) { rex(false, 0, 0, reg, false); byte(0x50 | (reg & 7)); }
+    void pop(int reg) { rex(false, 0, 0, reg, false); byte(0x58 | (reg & 7)); }
+    void call(const Mem &function) { op({0xff}, 2, function); }
+    void ret() { byte(0xc3); }
+
+    int label()
+    {
+        labels.push_back(-1);
+        return static_cast<int>(labels.size()) - 1;
+    }
+    void bind(int label) { labels[label] = static_cast<int>(code.size()); }
+    void jcc(Cond cond, int label) { byte(0x0f); byte(0x80 | cond); fixup(label); }
+    void jmp(int label) { byte(0xe9); fixup(label); }
+
+    // Resolves jumps once every label is bound.
+    void finish()
+    {
+        for (const auto &fixup : fixups) {
+            int32_t rel = labels[fixup.second] - static_cast<int32_t>(fixup.first + 4);
+            std::memcpy(&code[fixup.first], &rel, sizeof(rel));
+        }
+    }
+
+private:
+    void rex(bool wide, int reg, int index, int base, bool force)
+    {
+        uint8_t prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | (base >> 3);
+        if (prefix != 0x40 || force)
+            byte(prefix);
+    }
+    void fixup(int label)
+    {
+        fixups.emplace_back(code.size(), label);
+        dword(0);
+    }
+
+    std::vector<int> labels;
+    std::vector<std::pair<size_t, int>> fixups;
+};
+
+// Whether an instruction writes its operand.
+bool writes(uint8_t opcode)
+{
+    InstructionGroup group = instruction_group(opcode);
+    int op = (opcode & OperationMask) >> OperationShift;
+    switch (group) {
+    case InstructionGroup::Type1:
+        return op == STA;
+    case InstructionGroup::Type2:
+        return op != LDX;
+    case InstructionGroup::Type0:
+        return op == STY;
+    default:
+        return false;
+    }
+}
+
+// Translates one block, keeping to the interpreter's semantics in CPU.cpp
+// instruction for instruction, cycle quirks included.
+//
+// rbx holds the BlockState, r12-r14 internal RAM and the read and write page
+// tables, ebp the cycles run so far and r15d the current instruction's
+// effective address. 6502 registers and flags stay in the BlockState.
+class BlockCompiler {
+public:
+    BlockCompiler(const uint8_t *bank, uint16_t base) : bank(bank), base(base) {}
+
+    // Returns false if not even the first instruction can be compiled.
+    bool compile(uint16_t offset);
+    std::vector<uint8_t> &code() { return as.code; }
+
+private:
+    static constexpr int MaxInstructions = 48;
+
+    // Where an instruction's operand is: the operand itself, zero page, or
+    // anywhere on the bus. Without a fixed address it is in r15d.
+    struct Operand {
+        enum Kind { Value, ZeroPage, Memory } kind;
+        bool fixed;
+        uint16_t address;
+        // The index register, if the addressing mode takes the page-cross cycle.
+        int penalty_index;
+    };
+
+    static Mem state(size_t offset) { return Mem{RBX, -1, 1, static_cast<int32_t>(offset)}; }
+    static Mem ram(int32_t addr) { return Mem{R12, -1, 1, addr}; }
+
+    bool compilable(uint8_t opcode, uint16_t operand, bool first) const;
+    bool instruction(uint16_t pc, uint8_t opcode, uint16_t operand, bool first);
+    Operand address(uint8_t opcode, uint16_t operand);
+    void load(const Operand &operand, bool first, int exit);
+    void store(const Operand &operand, bool first, int exit);
+    void read_cart(const Operand &operand);
+    void write_cart(const Operand &operand);
+    void compare(const Operand &operand, size_t reg, bool first, int exit);
+    void add_with_carry();
+    void set_zn(int reg);
+    void set_status();
+    void push(int reg);
+    void push(uint8_t value);
+    void pop(int reg);
+    void add_cycles(int cycles, const Operand *operand = nullptr);
+
+    // A label that leaves the block with pc set to `pc`.
+    int exit_to(uint16_t pc);
+
+    const uint8_t *bank;
+    uint16_t base;
+    Assembler as;
+    int epilogue = -1;
+    std::map<uint16_t, int> exits;
+    // Taken branches: label, cycles and target.
+    struct Branch {
+        int label;
+        int cycles;
+        uint16_t target;
+    };
+    std::vector<Branch> branches;
+};
+
+bool BlockCompiler::compile(uint16_t offset)
+{
+    epilogue = as.label();
+
+    as.push(RBX);
+    as.push(RBP);
+    as.push(R12);
+    as.push(R13);
+    as.push(R14);
+    as.push(R15);
+    // Keeps the stack 16-byte aligned for calls into the bus.
+    as.op({0x83}, 5, RSP, true);
+    as.byte(8);
+    as.mov64(RBX, RDI);
+    as.load64(R12, state(offsetof(BlockState, ram)));
+    as.load64(R13, state(offsetof(BlockState, read_pages)));
+    as.load64(R14, state(offsetof(BlockState, write_pages)));
+    as.alu(Xor, RBP, RBP);
+
+    for (int count = 0;; ++count) {
+        uint16_t pc = static_cast<uint16_t>(base + offset);
+        if (count == MaxInstructions || offset >= 0x2000) {
+            as.jmp(exit_to(pc));
+            break;
+        }
+
+        uint8_t opcode = bank[offset];
+        int length = instruction_length(opcode);
+        uint16_t operand = 0;
+        if (offset + length <= 0x2000 && length > 1)
+            operand = bank[offset + 1] | (length > 2 ? bank[offset + 2] << 8 : 0);
+        if (offset + length > 0x2000 || !compilable(opcode, operand, count == 0)) {
+            if (count == 0)
+                return false;
+            as.jmp(exit_to(pc));
+            break;
+        }
+
+        if (count > 0) {
+            as.alu(Cmp, RBP, state(offsetof(BlockState, budget)));
+            as.jcc(CC_G, exit_to(pc));
+        }
+        offset += length;
+        if (!instruction(pc, opcode, operand, count == 0))
+            break;
+    }
+
+    for (const Branch &branch : branches) {
+        as.bind(branch.label);
+        as.alu(Add, RBP, static_cast<uint32_t>(branch.cycles));
+        as.store16(state(offsetof(BlockState, pc)), branch.target);
+        as.jmp(epilogue);
+    }
+    for (const auto &exit : exits) {
+        as.bind(exit.second);
+        as.store16(state(offsetof(BlockState, pc)), exit.first);
+        as.jmp(epilogue);
+    }
+
+    as.bind(epilogue);
+    as.store32(state(offsetof(BlockState, cycles)), RBP);
+    as.op({0x83}, 0, RSP, true);
+    as.byte(8);
+    as.pop(R15);
+    as.pop(R14);
+    as.pop(R13);
+    as.pop(R12);
+    as.pop(RBP);
+    as.pop(RBX);
+    as.ret();
+    as.finish();
+    return true;
+}
+
+int BlockCompiler::exit_to(uint16_t pc)
+{
+    auto exit = exits.find(pc);
+    if (exit != exits.end())
+        return exit->second;
+    int label = as.label();
+    exits.emplace(pc, label);
+    return label;
+}
+
+// BRK and unknown opcodes are left to the interpreter, as are accesses with
+// side effects anywhere but in the first instruction.
+bool BlockCompiler::compilable(uint8_t opcode, uint16_t operand, bool first) const
+{
+    InstructionGroup group = instruction_group(opcode);
+    if (group == InstructionGroup::Unknown || opcode == BRK)
+        return false;
+    if (first)
+        return true;
+
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    if (opcode == JMPI)
+        return !is_io(operand) && !is_io((operand & 0xff00) | ((operand + 1) & 0xff));
+    bool absolute = (group == InstructionGroup::Type1 && mode == Absolute) ||
+                    ((group == InstructionGroup::Type2 || group == InstructionGroup::Type0) && mode == Addr_Absolute);
+    if (absolute)
+        return writes(opcode) ? !is_io_write(operand) : !is_io(operand);
+    return true;
+}
+
+BlockCompiler::Operand BlockCompiler::address(uint8_t opcode, uint16_t operand)
+{
+    InstructionGroup group = instruction_group(opcode);
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+    uint8_t zero_page = static_cast<uint8_t>(operand);
+
+    if (group == InstructionGroup::Type1) {
+        bool store = op == STA;
+        switch (mode) {
+        case IndexedIndirectX:
+            as.movzx8(RCX, state(offsetof(BlockState, x)));
+            as.alu(Add, RCX, static_cast<uint32_t>(zero_page));
+            as.alu(And, RCX, 0xffu);
+            as.movzx8(R15, Mem{R12, RCX, 1, 0});
+            as.alu(Add, RCX, 1u);
+            as.alu(And, RCX, 0xffu);
+            as.movzx8(RAX, Mem{R12, RCX, 1, 0});
+            as.shl(RAX, 8);
+            as.alu(Or, R15, RAX);
+            return {Operand::Memory, false, 0, -1};
+        case ZeroPage:
+            return {Operand::ZeroPage, true, zero_page, -1};
+        case Immediate:
+            return {Operand::Value, true, zero_page, -1};
+        case Absolute:
+            return {Operand::Memory, true, operand, -1};
+        case IndirectY:
+            as.movzx8(R15, ram(zero_page));
+            as.movzx8(RAX, ram((zero_page + 1) & 0xff));
+            as.shl(RAX, 8);
+            as.alu(Or, R15, RAX);
+            as.movzx8(RCX, state(offsetof(BlockState, y)));
+            as.alu(Add, R15, RCX);
+            as.alu(And, R15, 0xffffu);
+            return {Operand::Memory, false, 0, store ? -1 : static_cast<int>(offsetof(BlockState, y))};
+        case IndexedX:
+            as.movzx8(R15, state(offsetof(BlockState, x)));
+            as.alu(Add, R15, static_cast<uint32_t>(zero_page));
+            as.alu(And, R15, 0xffu);
+            return {Operand::ZeroPage, false, 0, -1};
+        case AbsoluteY:
+        case AbsoluteX: {
+            int index = static_cast<int>(mode == AbsoluteY ? offsetof(BlockState, y) : offsetof(BlockState, x));
+            as.movzx8(R15, state(index));
+            as.alu(Add, R15, static_cast<uint32_t>(operand));
+            as.alu(And, R15, 0xffffu);
+            return {Operand::Memory, false, 0, store ? -1 : index};
+        }
+        }
+    }
+
+    // Type 2 and type 0. LDX/STX index with Y instead of X.
+    int index = static_cast<int>(group == InstructionGroup::Type2 && (op == LDX || op == STX) ? offsetof(BlockState, y)
+                                                                                             : offsetof(BlockState, x));
+    switch (mode) {
+    case Addr_Immediate:
+        return {Operand::Value, true, zero_page, -1};
+    case Addr_ZeroPage:
+        return {Operand::ZeroPage, true, zero_page, -1};
+    case Addr_Absolute:
+        return {Operand::Memory, true, operand, -1};
+    case Addr_Indexed:
+        as.movzx8(R15, state(index));
+        as.alu(Add, R15, static_cast<uint32_t>(zero_page));
+        as.alu(And, R15, 0xffu);
+        return {Operand::ZeroPage, false, 0, -1};
+    case Addr_AbsoluteIndexed:
+        as.movzx8(R15, state(index));
+        as.alu(Add, R15, static_cast<uint32_t>(operand));
+        as.alu(And, R15, 0xffffu);
+        return {Operand::Memory, false, 0, index};
+    }
+    return {Operand::Value, true, 0, -1};
+}
+
+// Reads the operand into eax. Internal RAM is read inline and cartridge
+// memory through the bus. PPU, APU and I/O registers are read through the bus
+// by the first instruction; anywhere else they exit to `exit`.
+void BlockCompiler::load(const Operand &operand, bool first, int exit)
+{
+    if (operand.kind == Operand::Value) {
+        as.mov(RAX, static_cast<uint32_t>(operand.address));
+        return;
+    }
+    if (operand.kind == Operand::ZeroPage) {
+        if (operand.fixed)
+            as.movzx8(RAX, ram(operand.address));
+        else
+            as.movzx8(RAX, Mem{R12, R15, 1, 0});
+        return;
+    }
+    if (operand.fixed) {
+        if (operand.address < 0x2000) {
+            as.movzx8(RAX, ram(operand.address & 0x07ff));
+            return;
+        }
+        if (!is_io(operand.address)) {
+            read_cart(operand);
+            return;
+        }
+        as.mov64(RDI, RBX);
+        as.mov(RSI, static_cast<uint32_t>(operand.address));
+        as.call(state(offsetof(BlockState, read)));
+        return;
+    }
+
+    int internal = as.label();
+    int cart = as.label();
+    int done = as.label();
+    as.alu(Cmp, R15, 0x2000u);
+    as.jcc(CC_B, internal);
+    as.alu(Cmp, R15, 0x4020u);
+    as.jcc(CC_AE, cart);
+    if (first) {
+        as.mov64(RDI, RBX);
+        as.mov(RSI, R15);
+        as.call(state(offsetof(BlockState, read)));
+        as.jmp(done);
+    } else {
+        as.jmp(exit);
+    }
+
+    as.bind(cart);
+    read_cart(operand);
+    as.jmp(done);
+
+    as.bind(internal);
+    as.mov(RDX, R15);
+    as.alu(And, RDX, 0x07ffu);
+    as.movzx8(RAX, Mem{R12, RDX, 1, 0});
+    as.bind(done);
+}
+
+// Writes al to the operand, like load(). Mapper registers at $8000-$FFFF are
+// treated like the PPU, APU and I/O registers; PRG RAM below them is not.
+void BlockCompiler::store(const Operand &operand, bool first, int exit)
+{
+    if (operand.kind == Operand::ZeroPage) {
+        if (operand.fixed)
+            as.store8(ram(operand.address), RAX);
+        else
+            as.store8(Mem{R12, R15, 1, 0}, RAX);
+        return;
+    }
+    if (operand.fixed) {
+        if (operand.address < 0x2000) {
+            as.store8(ram(operand.address & 0x07ff), RAX);
+            return;
+        }
+        if (!is_io_write(operand.address)) {
+            write_cart(operand);
+            return;
+        }
+        as.mov(RDX, RAX);
+        as.mov64(RDI, RBX);
+        as.mov(RSI, static_cast<uint32_t>(operand.address));
+        as.call(state(offsetof(BlockState, write)));
+        return;
+    }
+
+    int internal = as.label();
+    int io = as.label();
+    int cart = as.label();
+    int done = as.label();
+    as.alu(Cmp, R15, 0x2000u);
+    as.jcc(CC_B, internal);
+    as.alu(Cmp, R15, 0x4020u);
+    as.jcc(CC_B, io);
+    as.alu(Cmp, R15, 0x8000u);
+    as.jcc(CC_B, cart);
+
+    as.bind(io);
+    if (first) {
+        as.mov(RDX, RAX);
+        as.mov64(RDI, RBX);
+        as.mov(RSI, R15);
+        as.call(state(offsetof(BlockState, write)));
+        as.jmp(done);
+    } else {
+        as.jmp(exit);
+    }
+
+    as.bind(cart);
+    write_cart(operand);
+    as.jmp(done);
+
+    as.bind(internal);
+    as.mov(RDX, R15);
+    as.alu(And, RDX, 0x07ffu);
+    as.store8(Mem{R12, RDX, 1, 0}, RAX);
+    as.bind(done);
+}
+
+// Reads a cartridge byte at the operand's address into eax: straight from
+// the page it is on if the read page table maps it, else via read_cart().
+void BlockCompiler::read_cart(const Operand &operand)
+{
+    int slow = as.label();
+    int done = as.label();
+    if (operand.fixed) {
+        as.load64(RCX, Mem{R13, -1, 1, (operand.address >> 8) * 8});
+    } else {
+        as.mov(RDX, R15);
+        as.shr(RDX, 8);
+        as.load64(RCX, Mem{R13, RDX, 8, 0});
+    }
+    as.test64(RCX, RCX);
+    as.jcc(CC_E, slow);
+    if (operand.fixed) {
+        as.movzx8(RAX, Mem{RCX, -1, 1, operand.address & 0xff});
+    } else {
+        as.mov(RDX, R15);
+        as.alu(And, RDX, 0xffu);
+        as.movzx8(RAX, Mem{RCX, RDX, 1, 0});
+    }
+    as.jmp(done);
+
+    as.bind(slow);
+    as.mov64(RDI, RBX);
+    if (operand.fixed)
+        as.mov(RSI, static_cast<uint32_t>(operand.address));
+    else
+        as.mov(RSI, R15);
+    as.call(state(offsetof(BlockState, read_cart)));
+    as.bind(done);
+}
+
+// Writes al to PRG RAM at the operand's address, like read_cart(). Pages the
+// write page table maps are plain RAM, so writing them can't switch banks.
+void BlockCompiler::write_cart(const Operand &operand)
+{
+    int slow = as.label();
+    int done = as.label();
+    if (operand.fixed) {
+        as.load64(RCX, Mem{R14, -1, 1, (operand.address >> 8) * 8});
+    } else {
+        as.mov(RDX, R15);
+        as.shr(RDX, 8);
+        as.load64(RCX, Mem{R14, RDX, 8, 0});
+    }
+    as.test64(RCX, RCX);
+    as.jcc(CC_E, slow);
+    if (operand.fixed) {
+        as.store8(Mem{RCX, -1, 1, operand.address & 0xff}, RAX);
+    } else {
+        as.mov(RDX, R15);
+        as.alu(And, RDX, 0xffu);
+        as.store8(Mem{RCX, RDX, 1, 0}, RAX);
+    }
+    as.jmp(done);
+
+    as.bind(slow);
+    as.mov(RDX, RAX);
+    as.mov64(RDI, RBX);
+    if (operand.fixed)
+        as.mov(RSI, static_cast<uint32_t>(operand.address));
+    else
+        as.mov(RSI, R15);
+    as.call(state(offsetof(BlockState, write_cart)));
+    as.bind(done);
+}
+
+// CMP, CPX and CPY: carry is reg >= operand, Z and N come from the difference.
+void BlockCompiler::compare(const Operand &operand, size_t reg, bool first, int exit)
+{
+    load(operand, first, exit);
+    as.movzx8(RCX, state(reg));
+    as.alu(Cmp, RCX, RAX);
+    as.setcc(CC_AE, RDX);
+    as.store8(state(offsetof(BlockState, carry)), RDX);
+    as.alu(Sub, RCX, RAX);
+    set_zn(RCX);
+}
+
+// a + eax + carry, setting C, V, Z and N. SBC passes the operand's complement.
+void BlockCompiler::add_with_carry()
+{
+    as.movzx8(RCX, state(offsetof(BlockState, a)));
+    as.movzx8(RDX, state(offsetof(BlockState, carry)));
+    as.mov(RSI, RCX);
+    as.alu(Add, RSI, RAX);
+    as.alu(Add, RSI, RDX);
+    // Overflow: the sum's sign differs from both operands'.
+    as.alu(Xor, RCX, RSI);
+    as.alu(Xor, RAX, RSI);
+    as.alu(And, RCX, RAX);
+    as.shr(RCX, 7);
+    as.alu(And, RCX, 1u);
+    as.store8(state(offsetof(BlockState, overflow)), RCX);
+    as.mov(RDX, RSI);
+    as.shr(RDX, 8);
+    as.store8(state(offsetof(BlockState, carry)), RDX);
+    as.store8(state(offsetof(BlockState, a)), RSI);
+    set_zn(RSI);
+}
+
+void BlockCompiler::set_zn(int reg)
+{
+    as.store8(state(offsetof(BlockState, zero_result)), reg);
+    as.store8(state(offsetof(BlockState, negative_result)), reg);
+}
+
+// Status byte in eax to flags, as CPU::set_status() does.
+void BlockCompiler::set_status()
+{
+    as.store8(state(offsetof(BlockState, flags)), RAX);
+    as.mov(RDX, RAX);
+    as.alu(And, RDX, 1u);
+    as.store8(state(offsetof(BlockState, carry)), RDX);
+    as.mov(RDX, RAX);
+    as.shr(RDX, 6);
+    as.alu(And, RDX, 1u);
+    as.store8(state(offsetof(BlockState, overflow)), RDX);
+    as.mov(RDX, RAX);
+    as.alu(And, RDX, 2u);
+    as.setcc(CC_E, RDX);
+    as.store8(state(offsetof(BlockState, zero_result)), RDX);
+    as.mov(RDX, RAX);
+    as.alu(And, RDX, 0x80u);
+    as.store8(state(offsetof(BlockState, negative_result)), RDX);
+}
+
+void BlockCompiler::push(int reg)
+{
+    as.movzx8(RCX, state(offsetof(BlockState, sp)));
+    as.store8(Mem{R12, RCX, 1, 0x100}, reg);
+    as.alu(Sub, RCX, 1u);
+    as.store8(state(offsetof(BlockState, sp)), RCX);
+}
+
+void BlockCompiler::push(uint8_t value)
+{
+    as.movzx8(RCX, state(offsetof(BlockState, sp)));
+    as.store8(Mem{R12, RCX, 1, 0x100}, value);
+    as.alu(Sub, RCX, 1u);
+    as.store8(state(offsetof(BlockState, sp)), RCX);
+}
+
+void BlockCompiler::pop(int reg)
+{
+    as.movzx8(RCX, state(offsetof(BlockState, sp)));
+    as.alu(Add, RCX, 1u);
+    as.alu(And, RCX, 0xffu);
+    as.store8(state(offsetof(BlockState, sp)), RCX);
+    as.movzx8(reg, Mem{R12, RCX, 1, 0x100});
+}
+
+// Adds an instruction's cycles, plus one if its indexed address crossed a
+// page: the index register is unchanged, so that is when the low byte of the
+// address is below it.
+void BlockCompiler::add_cycles(int cycles, const Operand *operand)
+{
+    if (!operand || operand->penalty_index < 0) {
+        as.alu(Add, RBP, static_cast<uint32_t>(cycles));
+        return;
+    }
+    as.mov(RAX, R15);
+    as.alu(And, RAX, 0xffu);
+    as.movzx8(RCX, state(operand->penalty_index));
+    as.alu(Cmp, RAX, RCX);
+    as.alu(Adc, RBP, static_cast<uint32_t>(cycles));
+}
+
+// Emits one instruction. Returns false if it ends the block.
+bool BlockCompiler::instruction(uint16_t pc, uint8_t opcode, uint16_t operand, bool first)
+{
+    InstructionGroup group = instruction_group(opcode);
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+    int cycles = OperationCycles[opcode];
+    uint16_t next = static_cast<uint16_t>(pc + instruction_length(opcode));
+    int exit = exit_to(pc);
+
+    if (group == InstructionGroup::Implied) {
+        const size_t a = offsetof(BlockState, a), x = offsetof(BlockState, x), y = offsetof(BlockState, y);
+        const size_t sp = offsetof(BlockState, sp), flags = offsetof(BlockState, flags);
+        auto transfer = [&](size_t from, size_t to, bool zn) {
+            as.movzx8(RAX, state(from));
+            as.store8(state(to), RAX);
+            if (zn)
+                set_zn(RAX);
+        };
+        auto step = [&](size_t reg, Alu kind) {
+            as.movzx8(RAX, state(reg));
+            as.alu(kind, RAX, 1u);
+            as.store8(state(reg), RAX);
+            set_zn(RAX);
+        };
+        auto mask = [&](Alu kind, uint8_t bits) {
+            as.movzx8(RAX, state(flags));
+            as.alu(kind, RAX, static_cast<uint32_t>(bits));
+            as.store8(state(flags), RAX);
+        };
+
+        switch (static_cast<OperationImplied>(opcode)) {
+        case NOP: break;
+        case JSR:
+            push(static_cast<uint8_t>((next - 1) >> 8));
+            push(static_cast<uint8_t>(next - 1));
+            add_cycles(cycles);
+            as.jmp(exit_to(operand));
+            return false;
+        case RTS:
+            pop(RAX);
+            pop(RDX);
+            as.shl(RDX, 8);
+            as.alu(Or, RAX, RDX);
+            as.alu(Add, RAX, 1u);
+            as.store16(state(offsetof(BlockState, pc)), RAX);
+            add_cycles(cycles);
+            as.jmp(epilogue);
+            return false;
+        case RTI:
+            pop(RAX);
+            set_status();
+            pop(R15);
+            pop(RAX);
+            as.shl(RAX, 8);
+            as.alu(Or, RAX, R15);
+            as.store16(state(offsetof(BlockState, pc)), RAX);
+            add_cycles(cycles);
+            as.jmp(epilogue);
+            return false;
+        case JMP:
+            add_cycles(cycles);
+            as.jmp(exit_to(operand));
+            return false;
+        case JMPI: {
+            // The high byte comes from the start of the same page if the
+            // pointer is at the end of one.
+            uint16_t high = (operand & 0xff00) | ((operand + 1) & 0xff);
+            load({Operand::Memory, true, operand, -1}, first, exit);
+            as.mov(R15, RAX);
+            load({Operand::Memory, true, high, -1}, first, exit);
+            as.shl(RAX, 8);
+            as.alu(Or, RAX, R15);
+            as.store16(state(offsetof(BlockState, pc)), RAX);
+            add_cycles(cycles);
+            as.jmp(epilogue);
+            return false;
+        }
+        case PHP:
+            // get_flags(): I, D, B and U from flags, the others from the lazy flags.
+            as.movzx8(RAX, state(flags));
+            as.alu(And, RAX, 0x3cu);
+            as.movzx8(RCX, state(offsetof(BlockState, carry)));
+            as.alu(Or, RAX, RCX);
+            as.movzx8(RCX, state(offsetof(BlockState, overflow)));
+            as.shl(RCX, 6);
+            as.alu(Or, RAX, RCX);
+            as.movzx8(RCX, state(offsetof(BlockState, negative_result)));
+            as.alu(And, RCX, 0x80u);
+            as.alu(Or, RAX, RCX);
+            as.movzx8(RCX, state(offsetof(BlockState, zero_result)));
+            as.test(RCX, RCX);
+            as.setcc(CC_E, RCX);
+            as.movzx8(RCX, RCX);
+            as.shl(RCX, 1);
+            as.alu(Or, RAX, RCX);
+            push(RAX);
+            break;
+        case PLP:
+            // May unmask a pending IRQ, which the interpreter takes next.
+            pop(RAX);
+            set_status();
+            add_cycles(cycles);
+            as.jmp(exit_to(next));
+            return false;
+        case PHA:
+            as.movzx8(RAX, state(a));
+            push(RAX);
+            break;
+        case PLA:
+            pop(RAX);
+            as.store8(state(a), RAX);
+            set_zn(RAX);
+            break;
+        case DEY: step(y, Sub); break;
+        case DEX: step(x, Sub); break;
+        case INY: step(y, Add); break;
+        case INX: step(x, Add); break;
+        case TAY: transfer(a, y, true); break;
+        case TYA: transfer(y, a, true); break;
+        case TXA: transfer(x, a, true); break;
+        case TAX: transfer(a, x, true); break;
+        case TSX: transfer(sp, x, true); break;
+        case TXS: transfer(x, sp, false); break;
+        case CLC: as.store8(state(offsetof(BlockState, carry)), static_cast<uint8_t>(0)); break;
+        case SEC: as.store8(state(offsetof(BlockState, carry)), static_cast<uint8_t>(1)); break;
+        case CLV: as.store8(state(offsetof(BlockState, overflow)), static_cast<uint8_t>(0)); break;
+        case SEI: mask(Or, 0x04); break;
+        case CLD: mask(And, static_cast<uint8_t>(~0x08)); break;
+        case SED: mask(Or, 0x08); break;
+        case CLI:
+            mask(And, static_cast<uint8_t>(~0x04));
+            add_cycles(cycles);
+            as.jmp(exit_to(next));
+            return false;
+        case BRK:
+            break;
+        }
+        add_cycles(cycles);
+        return true;
+    }
+
+    if (group == InstructionGroup::Branch) {
+        bool on_set = opcode & BranchConditionMask;
+        Cond set = CC_NE;
+        switch (opcode >> BranchOnFlagShift) {
+        case Negative:
+            as.movzx8(RAX, state(offsetof(BlockState, negative_result)));
+            as.alu(And, RAX, 0x80u);
+            break;
+        case Overflow:
+            as.movzx8(RAX, state(offsetof(BlockState, overflow)));
+            as.test(RAX, RAX);
+            break;
+        case Carry:
+            as.movzx8(RAX, state(offsetof(BlockState, carry)));
+            as.test(RAX, RAX);
+            break;
+        case Zero:
+            as.movzx8(RAX, state(offsetof(BlockState, zero_result)));
+            as.test(RAX, RAX);
+            set = CC_E;
+            break;
+        }
+        Cond taken = on_set ? set : static_cast<Cond>(set ^ 1);
+
+        // Taken branches leave the block; the fall-through carries on.
+        uint16_t target = static_cast<uint16_t>(next + static_cast<int8_t>(operand));
+        int label = as.label();
+        branches.push_back({label, cycles + 1 + ((next & 0xff00) != (target & 0xff00)), target});
+        as.jcc(taken, label);
+        add_cycles(cycles);
+        return true;
+    }
+
+    // Accumulator shifts.
+    if (group == InstructionGroup::Type2 && mode == Addr_Accumulator) {
+        as.movzx8(RAX, state(offsetof(BlockState, a)));
+        if (op == ASL || op == ROL) {
+            as.mov(RDX, RAX);
+            as.shr(RDX, 7);
+            as.shl(RAX, 1);
+            if (op == ROL) {
+                as.movzx8(RCX, state(offsetof(BlockState, carry)));
+                as.alu(Or, RAX, RCX);
+            }
+        } else {
+            as.mov(RDX, RAX);
+            as.alu(And, RDX, 1u);
+            as.shr(RAX, 1);
+            if (op == ROR) {
+                as.movzx8(RCX, state(offsetof(BlockState, carry)));
+                as.shl(RCX, 7);
+                as.alu(Or, RAX, RCX);
+            }
+        }
+        as.store8(state(offsetof(BlockState, carry)), RDX);
+        as.store8(state(offsetof(BlockState, a)), RAX);
+        set_zn(RAX);
+        add_cycles(cycles);
+        return true;
+    }
+
+    Operand target = address(opcode, operand);
+    if (group == InstructionGroup::Type1) {
+        switch (op) {
+        case ORA:
+        case AND:
+        case EOR:
+            load(target, first, exit);
+            as.movzx8(RCX, state(offsetof(BlockState, a)));
+            as.alu(op == ORA ? Or : op == AND ? And : Xor, RAX, RCX);
+            as.store8(state(offsetof(BlockState, a)), RAX);
+            set_zn(RAX);
+            break;
+        case ADC:
+        case SBC:
+            load(target, first, exit);
+            if (op == SBC)
+                as.alu(Xor, RAX, 0xffu);
+            add_with_carry();
+            break;
+        case STA:
+            as.movzx8(RAX, state(offsetof(BlockState, a)));
+            store(target, first, exit);
+            break;
+        case LDA:
+            load(target, first, exit);
+            as.store8(state(offsetof(BlockState, a)), RAX);
+            set_zn(RAX);
+            break;
+        case CMP:
+            compare(target, offsetof(BlockState, a), first, exit);
+            break;
+        }
+    } else if (group == InstructionGroup::Type2) {
+        switch (op) {
+        case STX:
+            as.movzx8(RAX, state(offsetof(BlockState, x)));
+            store(target, first, exit);
+            break;
+        case LDX:
+            load(target, first, exit);
+            as.store8(state(offsetof(BlockState, x)), RAX);
+            set_zn(RAX);
+            break;
+        default: {
+            // Read-modify-write. Nothing is committed until the write has
+            // gone through, so a later instruction can still exit before it.
+            bool shift = op == ASL || op == ROL || op == LSR || op == ROR;
+            load(target, first, exit);
+            if (op == ASL || op == ROL) {
+                as.mov(RDX, RAX);
+                as.shr(RDX, 7);
+                as.shl(RAX, 1);
+                if (op == ROL) {
+                    as.movzx8(RCX, state(offsetof(BlockState, carry)));
+                    as.alu(Or, RAX, RCX);
+                }
+            } else if (op == LSR || op == ROR) {
+                as.mov(RDX, RAX);
+                as.alu(And, RDX, 1u);
+                as.shr(RAX, 1);
+                if (op == ROR) {
+                    as.movzx8(RCX, state(offsetof(BlockState, carry)));
+                    as.shl(RCX, 7);
+                    as.alu(Or, RAX, RCX);
+                }
+            } else {
+                as.alu(op == INC ? Add : Sub, RAX, 1u);
+            }
+            if (shift)
+                as.store8(state(offsetof(BlockState, scratch)), RDX);
+            as.store8(state(offsetof(BlockState, scratch) + 1), RAX);
+            store(target, first, exit);
+            if (shift) {
+                as.movzx8(RAX, state(offsetof(BlockState, scratch)));
+                as.store8(state(offsetof(BlockState, carry)), RAX);
+            }
+            as.movzx8(RAX, state(offsetof(BlockState, scratch) + 1));
+            set_zn(RAX);
+            break;
+        }
+        }
+    } else {
+        switch (op) {
+        case BIT:
+            load(target, first, exit);
+            as.movzx8(RCX, state(offsetof(BlockState, a)));
+            as.alu(And, RCX, RAX);
+            as.store8(state(offsetof(BlockState, zero_result)), RCX);
+            as.store8(state(offsetof(BlockState, negative_result)), RAX);
+            as.shr(RAX, 6);
+            as.alu(And, RAX, 1u);
+            as.store8(state(offsetof(BlockState, overflow)), RAX);
+            break;
+        case STY:
+            as.movzx8(RAX, state(offsetof(BlockState, y)));
+            store(target, first, exit);
+            break;
+        case LDY:
+            load(target, first, exit);
+            as.store8(state(offsetof(BlockState, y)), RAX);
+            set_zn(RAX);
+            break;
+        case CPX:
+            compare(target, offsetof(BlockState, x), first, exit);
+            break;
+        case CPY:
+            compare(target, offsetof(BlockState, y), first, exit);
+            break;
+        }
+    }
+    add_cycles(cycles, &target);
+
+    // Whatever the bus did (a DMA, an interrupt, a bank switch) is for the
+    // caller to see before anything else runs.
+    if ((first || writes(opcode)) && target.kind == Operand::Memory && !(target.fixed && target.address < 0x2000)) {
+        as.movzx8(RAX, state(offsetof(BlockState, io)));
+        as.test(RAX, RAX);
+        as.jcc(CC_NE, exit_to(next));
+    }
+    return true;
+}
+
+} // namespace
+
+bool JitX64::supported()
+{
+    return JIT_X64_SUPPORTED;
+}
+
+JitX64::JitX64(const uint8_t *prg, uint32_t prg_size) : prg(prg), tables((prg_size / 0x2000) * 4) {}
+
+JitX64::~JitX64()
+{
+#if JIT_X64_SUPPORTED
+    for (const Chunk &chunk : chunks)
+        munmap(chunk.memory, ChunkSize);
+#endif
+}
+
+CompiledBlock JitX64::compile(Entry &entry, uint32_t bank, int window, uint16_t offset)
+{
+    BlockCompiler compiler(prg + bank * 0x2000, static_cast<uint16_t>(0x8000 + window * 0x2000));
+    if (!compiler.compile(offset)) {
+        entry.count = Never;
+        return nullptr;
+    }
+    entry.block = install(compiler.code());
+    if (!entry.block)
+        entry.count = Never;
+    return entry.block;
+}
+
+CompiledBlock JitX64::install(const std::vector<uint8_t> &code)
+{
+#if JIT_X64_SUPPORTED
+    if (code.size() > ChunkSize)
+        return nullptr;
+    if (chunks.empty() || chunks.back().used + code.size() > ChunkSize) {
+        void *memory = mmap(nullptr, ChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw std::runtime_error("Failed to allocate memory for compiled code");
+        chunks.push_back({static_cast<uint8_t*>(memory), 0});
+    }
+
+    // Never writable and executable at once.
+    Chunk &chunk = chunks.back();
+    if (mprotect(chunk.memory, ChunkSize, PROT_READ | PROT_WRITE) != 0)
+        throw std::runtime_error("Failed to make compiled code writable");
+    uint8_t *start = chunk.memory + chunk.used;
+    std::memcpy(start, code.data(), code.size());
+    chunk.used += (code.size() + 15) & ~static_cast<size_t>(15);
+    if (mprotect(chunk.memory, ChunkSize, PROT_READ | PROT_EXEC) != 0)
+        throw std::runtime_error("Failed to make compiled code executable");
+    return reinterpret_cast<CompiledBlock>(start);
+#else
+    (void)code;
+    return nullptr;
+#endif
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "compiled_block.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Native x86-64 code for hot PRG ROM code (BusOptions::jit).
+//
+// A block runs from one entry point in an 8KB ROM bank through straight-line
+// code and not-taken branches, and ends at a taken branch, a jump, a return,
+// anything that can unmask an interrupt, or the end of the bank. Each
+// instruction after the first only starts within the caller's cycle budget,
+// so nothing scheduled can fall due inside a block. Internal RAM is accessed
+// directly and cartridge memory through the bus's page tables, calling into
+// the bus only where they map nothing. An access with side effects (PPU, APU,
+// I/O or mapper registers) is made by the first instruction only, and ends
+// the block. A later instruction that would need one ends the block before
+// it, for the interpreter to run next time.
+//
+// Code in RAM or PRG RAM is never compiled, so it can modify itself freely.
+// Only available on x86-64 POSIX hosts.
+class JitX64 {
+public:
+    static bool supported();
+
+    JitX64(const uint8_t *prg, uint32_t prg_size);
+    ~JitX64();
+
+    JitX64(const JitX64&) = delete;
+    JitX64& operator=(const JitX64&) = delete;
+
+    // The block starting at `offset` in PRG ROM bank `bank` while that bank
+    // is mapped at window `window` ($8000 + window * $2000), or nullptr while
+    // the code there is still cold or can't be compiled.
+    CompiledBlock block(uint32_t bank, int window, uint16_t offset)
+    {
+        Entry &entry = entries(bank, window)[offset];
+        if (entry.block || entry.count == Never)
+            return entry.block;
+        return ++entry.count < HotCount ? nullptr : compile(entry, bank, window, offset);
+    }
+
+private:
+    static constexpr uint16_t HotCount = 16;
+    static constexpr uint16_t Never = UINT16_MAX;
+    static constexpr size_t ChunkSize = 256 * 1024;
+
+    struct Entry {
+        CompiledBlock block = nullptr;
+        // Entries seen so far, or Never if the first instruction can't be compiled.
+        uint16_t count = 0;
+    };
+
+    Entry *entries(uint32_t bank, int window)
+    {
+        std::unique_ptr<Entry[]> &table = tables[bank * 4 + window];
+        if (!table)
+            table.reset(new Entry[0x2000]);
+        return table.get();
+    }
+    CompiledBlock compile(Entry &entry, uint32_t bank, int window, uint16_t offset);
+    // Copies finished code into executable memory.
+    CompiledBlock install(const std::vector<uint8_t> &code);
+
+    const uint8_t *prg;
+    std::vector<std::unique_ptr<Entry[]>> tables;
+
+    // Executable memory, in chunks that are only writable while code is
+    // being copied in.
+    struct Chunk {
+        uint8_t *memory;
+        size_t used;
+    };
+    std::vector<Chunk> chunks;
+};
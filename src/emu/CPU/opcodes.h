@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 const auto InstructionModeMask = 0x3;
 
 const constexpr auto OperationMask = 0xE0;
@@ -113,7 +115,7 @@ enum InterruptType {
 };
 
 // 0 = unused opcode
-static const int OperationCycles[0x100] = {
+static constexpr int OperationCycles[0x100] = {
     7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,
     2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
     6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,
@@ -131,3 +133,79 @@ static const int OperationCycles[0x100] = {
     2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 2, 4, 4, 6, 0,
     2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
 };
+
+// Which of the decoders an opcode belongs to. Groups are tried in the order
+// implied, branch, type 1, type 2, type 0; opcodes without a cycle count (or
+// with an addressing mode / operation the decoders don't handle) are Unknown.
+enum class InstructionGroup {
+    Unknown,
+    Implied,
+    Branch,
+    Type1,
+    Type2,
+    Type0,
+};
+
+constexpr bool is_implied_opcode(uint8_t opcode)
+{
+    switch (static_cast<OperationImplied>(opcode)) {
+    case NOP: case BRK: case JSR: case RTI: case RTS: case JMP: case JMPI:
+    case PHP: case PLP: case PHA: case PLA:
+    case DEY: case DEX: case TAY: case INY: case INX:
+    case CLC: case SEC: case CLI: case SEI: case TYA: case CLV: case CLD: case SED:
+    case TXA: case TXS: case TAX: case TSX:
+        return true;
+    }
+    return false;
+}
+
+constexpr InstructionGroup instruction_group(uint8_t opcode)
+{
+    if (OperationCycles[opcode] == 0)
+        return InstructionGroup::Unknown;
+    if (is_implied_opcode(opcode))
+        return InstructionGroup::Implied;
+    if ((opcode & BranchInstructionMask) == BranchInstructionMaskResult)
+        return InstructionGroup::Branch;
+
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+    switch (opcode & InstructionModeMask) {
+    case 1:
+        return InstructionGroup::Type1;
+    case 2:
+        if (mode == 4 || mode == 6)
+            return InstructionGroup::Unknown;
+        return InstructionGroup::Type2;
+    case 0:
+        if (mode == 2 || mode == 4 || mode == 6)
+            return InstructionGroup::Unknown;
+        if (op != BIT && op != STY && op != LDY && op != CPY && op != CPX)
+            return InstructionGroup::Unknown;
+        return InstructionGroup::Type0;
+    }
+    return InstructionGroup::Unknown;
+}
+
+// Instruction length in bytes, opcode included. BRK counts as 1 since the
+// interrupt sequence skips its padding byte itself.
+constexpr int instruction_length(uint8_t opcode)
+{
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    switch (instruction_group(opcode)) {
+    case InstructionGroup::Implied:
+        return (opcode == JSR || opcode == JMP || opcode == JMPI) ? 3 : 1;
+    case InstructionGroup::Branch:
+        return 2;
+    case InstructionGroup::Type1:
+        return (mode == Absolute || mode == AbsoluteY || mode == AbsoluteX) ? 3 : 2;
+    case InstructionGroup::Type2:
+    case InstructionGroup::Type0:
+        if (mode == Addr_Accumulator)
+            return 1;
+        return (mode == Addr_Absolute || mode == Addr_AbsoluteIndexed) ? 3 : 2;
+    case InstructionGroup::Unknown:
+        break;
+    }
+    return 1;
+}
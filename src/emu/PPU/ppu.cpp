@@ -4,18 +4,65 @@
 #include <cstring>
 #include <algorithm>
 
+// The bus may still be under construction here, so the cartridge is left
+// until the first update_memory_map().
 PPU::PPU() : bus(nullptr) {
 	reset();
+	map_memory(nullptr);
 }
 
 PPU::PPU(Bus *bus) : bus(bus) {
 	reset();
+	map_memory(nullptr);
 }
 
 void PPU::connect(Bus *bus) {
 	this->bus = bus;
 }
 
+void PPU::update_memory_map() {
+	Cartridge *cart = bus ? bus->cart : nullptr;
+	if (cart && cart->mapper && chr_version != cart->mapper->get_chr_version())
+		map_memory(cart);
+}
+
+void PPU::map_memory(Cartridge *cart) {
+	Mapper *mapper = cart ? cart->mapper : nullptr;
+	chr_version = mapper ? mapper->get_chr_version() : UINT32_MAX;
+
+	// Only use CHR pages the mapper places linearly in CHR ROM or RAM.
+	bool direct = !mapper || bus->get_options().page_tables;
+	for (int page = 0; page < 8; ++page) {
+		uint16_t addr = page * 0x0400;
+		uint32_t first = UINT32_MAX, last = UINT32_MAX;
+		pages[page] = direct ? &pattern_table[page >> 2][(page & 3) * 0x0400] : nullptr;
+		if (!mapper || !direct || !mapper->chrRead(addr, first) || !mapper->chrRead(addr + 0x03FF, last))
+			continue;
+		if (last != first + 0x03FF || last >= cart->chr_size)
+			continue;
+		pages[page] = cart->chr + first;
+	}
+
+	Mirroring mirroring = cart ? cart->mirroring_type : Mirroring::HORIZONTAL;
+	int onescreen_bank = 0;
+	if (mapper && mirroring == Mirroring::SINGLE_SCREEN) {
+		int b = mapper->get_onescreen_bank();
+		if (b >= 0) onescreen_bank = b;
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		int bank;
+		if (mirroring == Mirroring::VERTICAL)
+			bank = i & 1;
+		else if (mirroring == Mirroring::HORIZONTAL)
+			bank = i >> 1;
+		else // SINGLE_SCREEN
+			bank = onescreen_bank;
+		nametable_pages[i] = nametable[bank];
+		pages[8 + i] = pages[12 + i] = nametable[bank];
+	}
+}
+
 PPUSaveState PPU::save_state() const {
 	PPUSaveState state{};
 	state.ctrl = ctrl;
@@ -90,6 +137,15 @@ void PPU::load_state(const PPUSaveState &state) {
 	std::memcpy(spriteScanline, state.spriteScanline, sizeof(spriteScanline));
 	std::memcpy(sprite_shifter_pattern_lo, state.sprite_shifter_pattern_lo, sizeof(sprite_shifter_pattern_lo));
 	std::memcpy(sprite_shifter_pattern_hi, state.sprite_shifter_pattern_hi, sizeof(sprite_shifter_pattern_hi));
+	// The cartridge may have been switched to other banks along with us.
+	map_memory(bus ? bus->cart : nullptr);
+}
+
+void PPU::copy_state(const PPU &other, bool copy_framebuffer) {
+	load_state(other.save_state());
+	if (copy_framebuffer) {
+		std::memcpy(framebuffer, other.framebuffer, sizeof(framebuffer));
+	}
 }
 
 void PPU::update_nmi_line() {
@@ -218,48 +274,20 @@ void PPU::dmaWrite(uint8_t data) {
 	oam_addr++;
 }
 
+uint8_t PPU::read_chr(uint16_t addr) {
+	uint8_t data = 0x00;
+	if (bus->cart->ppuRead(addr, data))
+		return data;
+	return pattern_table[(addr & 0x1000) >> 12][addr & 0x0FFF];
+}
+
 uint8_t PPU::ppuRead(uint16_t addr, bool readonly) {
 	uint8_t data = 0x00;
 	addr &= 0x3FFF;
 
-	Cartridge *cart = bus ? bus->cart : nullptr;
-	Mirroring mirroring = cart ? cart->mirroring_type : Mirroring::HORIZONTAL;
-	int onescreen_bank = 0;
-	if (cart && mirroring == Mirroring::SINGLE_SCREEN && cart->mapper) {
-		int b = cart->mapper->get_onescreen_bank();
-		if (b >= 0) onescreen_bank = b;
-	}
-
-	if (cart && cart->ppuRead(addr, data)) {
-		return data;
-	} else if (addr >= 0x0000 && addr <= 0x1FFF) {
-		data = pattern_table[(addr & 0x1000) >> 12][addr & 0x0FFF];
-	} else if (addr >= 0x2000 && addr <= 0x3EFF) {
-		addr &= 0x0FFF;
-
-		if (mirroring == Mirroring::VERTICAL) {
-			if (addr <= 0x03FF)
-				data = nametable[0][addr & 0x03FF];
-			else if (addr <= 0x07FF)
-				data = nametable[1][addr & 0x03FF];
-			else if (addr <= 0x0BFF)
-				data = nametable[0][addr & 0x03FF];
-			else
-				data = nametable[1][addr & 0x03FF];
-		} else if (mirroring == Mirroring::HORIZONTAL) {
-			if (addr <= 0x03FF)
-				data = nametable[0][addr & 0x03FF];
-			else if (addr <= 0x07FF)
-				data = nametable[0][addr & 0x03FF];
-			else if (addr <= 0x0BFF)
-				data = nametable[1][addr & 0x03FF];
-			else
-				data = nametable[1][addr & 0x03FF];
-		} else { // SINGLE_SCREEN
-			// All nametable accesses map to the selected onescreen bank
-			data = nametable[onescreen_bank][addr & 0x03FF];
-		}
-	} else if (addr >= 0x3F00 && addr <= 0x3FFF) {
+	if (addr < 0x3F00) {
+		data = fetch(addr);
+	} else {
 		addr &= 0x001F;
 		if (addr == 0x0010) addr = 0x0000;
 		if (addr == 0x0014) addr = 0x0004;
@@ -275,13 +303,6 @@ void PPU::ppuWrite(uint16_t addr, uint8_t data) {
 	addr &= 0x3FFF;
 
 	Cartridge *cart = bus ? bus->cart : nullptr;
-	Mirroring mirroring = cart ? cart->mirroring_type : Mirroring::HORIZONTAL;
-	int onescreen_bank = 0;
-	if (cart && mirroring == Mirroring::SINGLE_SCREEN && cart->mapper) {
-		int b = cart->mapper->get_onescreen_bank();
-		if (b >= 0) onescreen_bank = b;
-	}
-
 	if (!cart) {
 	    printf("PPU::ppuWrite: No cartridge loaded!\n");
 		return;
@@ -293,30 +314,7 @@ void PPU::ppuWrite(uint16_t addr, uint8_t data) {
 		pattern_table[(addr & 0x1000) >> 12][addr & 0x0FFF] = data;
 	}
 	else if (addr >= 0x2000 && addr <= 0x3EFF) {
-		addr &= 0x0FFF;
-		if (mirroring == Mirroring::VERTICAL) {
-			if (addr <= 0x03FF)
-				nametable[0][addr & 0x03FF] = data;
-			else if (addr <= 0x07FF)
-				nametable[1][addr & 0x03FF] = data;
-			else if (addr <= 0x0BFF)
-				nametable[0][addr & 0x03FF] = data;
-			else
-				nametable[1][addr & 0x03FF] = data;
-		}
-		else if (mirroring == Mirroring::HORIZONTAL) {
-			if (addr <= 0x03FF)
-				nametable[0][addr & 0x03FF] = data;
-			else if (addr <= 0x07FF)
-				nametable[0][addr & 0x03FF] = data;
-			else if (addr <= 0x0BFF)
-				nametable[1][addr & 0x03FF] = data;
-			else
-				nametable[1][addr & 0x03FF] = data;
-		}
-		else { // SINGLE_SCREEN
-			nametable[onescreen_bank][addr & 0x03FF] = data;
-		}
+		nametable_pages[(addr >> 10) & 0x03][addr & 0x03FF] = data;
 	}
 	else if (addr >= 0x3F00 && addr <= 0x3FFF) {
 		addr &= 0x001F;
@@ -361,6 +359,47 @@ void PPU::reset() {
 	sprite_zero_scanline = 0xFF;
 }
 
+int PPU::clocks_until(int target_scanline, int target_cycle) const {
+	constexpr int DOTS_PER_LINE = 341;
+	constexpr int DOTS_PER_FRAME = 262 * DOTS_PER_LINE;
+	// Scanline 0, cycle 0: skipped on odd frames while rendering.
+	constexpr int SKIPPED_DOT = DOTS_PER_LINE;
+
+	int from = (scanline + 1) * DOTS_PER_LINE + cycle;
+	int to = (target_scanline + 1) * DOTS_PER_LINE + target_cycle;
+	bool rendering = mask.show_bg || mask.show_sprite;
+	bool odd = odd_frame;
+
+	int clocks = to - from + 1;
+	if (to < from) {
+		// The rest of this frame, then the next one up to the target.
+		clocks += DOTS_PER_FRAME;
+		if (from <= SKIPPED_DOT && odd && rendering)
+			clocks--;
+		odd = !odd;
+		from = 0;
+	}
+	if (from <= SKIPPED_DOT && SKIPPED_DOT <= to && odd && rendering)
+		clocks--;
+	return clocks;
+}
+
+int PPU::clocks_until_status_change() const {
+	// Vblank starts, and the pre-render line clears all three flags.
+	int clocks = std::min(clocks_until(241, 1), clocks_until(-1, 1));
+	if (scanline < 240) {
+		// Sprite 0 hit can come on any rendered dot.
+		if (!status.sprite_zero_hit && mask.show_bg && mask.show_sprite)
+			return 1;
+		// Sprite evaluation for each visible line may set the overflow flag.
+		if (!status.sprite_overflow) {
+			int line = (scanline >= 0 && cycle < 257) ? scanline : scanline + 1;
+			clocks = std::min(clocks, clocks_until(line, 257));
+		}
+	}
+	return clocks;
+}
+
 void PPU::clock() {
 	auto IncrementScrollX = [&]() {
 		if (mask.show_bg || mask.show_sprite) {
@@ -465,10 +504,10 @@ void PPU::clock() {
 			switch ((cycle - 1) % 8) {
 			case 0:
 				LoadShifters();
-				bg_next_tile_id = ppuRead(0x2000 | (vram_addr.reg & 0x0FFF));
+				bg_next_tile_id = fetch(0x2000 | (vram_addr.reg & 0x0FFF));
 				break;
 			case 2:
-				bg_next_tile_attrib = ppuRead(0x23C0 | (vram_addr.nametable_y << 11)
+				bg_next_tile_attrib = fetch(0x23C0 | (vram_addr.nametable_y << 11)
 					                                 | (vram_addr.nametable_x << 10)
 					                                 | ((vram_addr.coarse_y >> 2) << 3)
 					                                 | (vram_addr.coarse_x >> 2));
@@ -478,10 +517,10 @@ void PPU::clock() {
 				break;
 
 			case 4:
-				bg_next_tile_lsb = ppuRead((ctrl.pattern_background << 12) + ((uint16_t)bg_next_tile_id << 4) + (vram_addr.fine_y) + 0);
+				bg_next_tile_lsb = fetch((ctrl.pattern_background << 12) + ((uint16_t)bg_next_tile_id << 4) + (vram_addr.fine_y) + 0);
 				break;
 			case 6:
-				bg_next_tile_msb = ppuRead((ctrl.pattern_background << 12) + ((uint16_t)bg_next_tile_id << 4) + (vram_addr.fine_y) + 8);
+				bg_next_tile_msb = fetch((ctrl.pattern_background << 12) + ((uint16_t)bg_next_tile_id << 4) + (vram_addr.fine_y) + 8);
 				break;
 			case 7:
 				IncrementScrollX();
@@ -528,11 +567,11 @@ void PPU::clock() {
 		}
 
 		if (cycle == 338 || cycle == 340) {
-			bg_next_tile_id = ppuRead(0x2000 | (vram_addr.reg & 0x0FFF));
+			bg_next_tile_id = fetch(0x2000 | (vram_addr.reg & 0x0FFF));
 		}
 
 		if (cycle == 340) {
-    		static unsigned char rb_lookup[16] = {
+    		static const unsigned char rb_lookup[16] = {
                 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
                 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
     		};
@@ -601,7 +640,15 @@ void PPU::clock() {
 	uint8_t bg_pixel = 0x00;
 	uint8_t bg_palette = 0x00;
 
-	if (mask.show_bg) {
+	// Without video output the pixel mux only matters for sprite 0 hit, which
+	// needs sprite 0 on this scanline. Everything else the CPU can observe
+	// (vblank, NMI, sprite overflow, VRAM reads) is handled above.
+	bool mux_pixel = render_video || sprite_zero_hit_possible;
+	if (!mux_pixel && mask.show_sprite) {
+		sprite_zero_being_rendered = false;
+	}
+
+	if (mux_pixel && mask.show_bg) {
 		uint16_t bit_mux = 0x8000 >> fine_x;
 		uint8_t p0_pixel = (bg_shifter_pattern_lo & bit_mux) > 0;
 		uint8_t p1_pixel = (bg_shifter_pattern_hi & bit_mux) > 0;
@@ -611,7 +658,7 @@ void PPU::clock() {
 		bg_palette = (bg_pal1 << 1) | bg_pal0;
 	}
 
-	if (mask.show_sprite) {
+	if (mux_pixel && mask.show_sprite) {
 		sprite_zero_being_rendered = false;
 		for (uint8_t i = 0; i < sprite_count; i++) {
 			if (spriteScanline[i].x == 0) {
@@ -669,7 +716,7 @@ void PPU::clock() {
 		}
 	}
 
-	if (scanline >= 0 && scanline < 240 && cycle >= 1 && cycle <= 256) {
+	if (render_video && scanline >= 0 && scanline < 240 && cycle >= 1 && cycle <= 256) {
 	    framebuffer[(scanline * 256) + (cycle - 1)] = get_color(palette, pixel);
 	}
 
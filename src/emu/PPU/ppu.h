@@ -3,6 +3,7 @@
 #include <cstdint>
 
 typedef class Bus Bus;
+typedef class Cartridge Cartridge;
 
 struct ObjectAttributeEntry {
     uint8_t y;
@@ -91,6 +92,13 @@ public:
     PPU();
     explicit PPU(Bus *bus);
     void connect(Bus *bus);
+
+    PPU(const PPU&) = delete;
+    PPU& operator=(const PPU&) = delete;
+
+    // Rebuilds the PPU's memory map if the cartridge's CHR banks or
+    // mirroring have changed since it was last built.
+    void update_memory_map();
 private:
 
     struct {
@@ -124,9 +132,9 @@ private:
 	v_reg vram_addr;
 	v_reg tram_addr;
 
-    uint8_t pattern_table[2][4096];
-    uint8_t palette_table[32];
-    uint8_t nametable[2][1024];
+    uint8_t pattern_table[2][4096] = {};
+    uint8_t palette_table[32] = {};
+    uint8_t nametable[2][1024] = {};
     uint8_t oam_addr = 0x00;
     ObjectAttributeEntry OAM[64];
     ObjectAttributeEntry spriteScanline[8];
@@ -169,6 +177,26 @@ private:
         0xF8D878, 0xD8F878, 0xB8F8B8, 0xB8F8D8, 0x00FCFC, 0xF8D8F8, 0x000000, 0x000000
     };
 
+    // $0000-$3EFF in 1KB pages, for reads: CHR as the cartridge maps it
+    // (pattern_table where the mapper maps nothing valid), then the
+    // nametables as mirrored, twice over. CHR pages are nullptr, and read
+    // through the mapper, without BusOptions::page_tables. nametable_pages
+    // is the same mirroring for writes. Palette accesses are picked out
+    // before any lookup. Both are rebuilt whenever the mapper reports a CHR
+    // banking or mirroring change.
+    const uint8_t *pages[16] = {};
+    uint8_t *nametable_pages[4] = {};
+    uint32_t chr_version = UINT32_MAX;
+    void map_memory(Cartridge *cart);
+    uint8_t read_chr(uint16_t addr);
+    // Background fetches, which always address CHR or the nametables.
+    // (Sprite fetches can run wild on the pre-render line and go through
+    // ppuRead().)
+    uint8_t fetch(uint16_t addr) {
+        const uint8_t *page = pages[addr >> 10];
+        return page ? page[addr & 0x03FF] : read_chr(addr);
+    }
+
     uint32_t get_color(uint8_t palette, uint8_t pixel);
     uint8_t* get_pattern_table(uint8_t i, uint8_t palette);
 
@@ -187,12 +215,29 @@ public:
 	void    ppuWrite(uint16_t addr, uint8_t data);
 
 
-    uint32_t framebuffer[256 * 240];
+    uint32_t framebuffer[256 * 240] = {};
 
 	void clock();
 	void reset();
+
+	// clock() calls up to and including the one that processes the given dot,
+	// assuming rendering isn't switched on or off in between (that decides
+	// whether the odd-frame dot is skipped).
+	int clocks_until(int target_scanline, int target_cycle) const;
+	// A lower bound on the clock() calls up to and including the one that
+	// next changes what a $2002 read returns, barring CPU register accesses.
+	// Same assumption as clocks_until().
+	int clocks_until_status_change() const;
     PPUSaveState save_state() const;
     void load_state(const PPUSaveState &state);
+    // Copies another PPU's state. The framebuffer is output only and is fully
+    // redrawn every frame, so callers cloning at a frame boundary can skip it.
+    void copy_state(const PPU &other, bool copy_framebuffer = true);
 	bool nmi = false;
 	bool frame_complete = false;
+
+	// When false the PPU skips palette lookups and framebuffer writes but keeps
+	// all timing, vblank/NMI, sprite 0 hit and sprite overflow behaviour exact.
+	// The framebuffer then holds stale pixels until a frame is rendered again.
+	bool render_video = true;
 };
@@ -0,0 +1,50 @@
+#include "batch_runner.h"
+
+#include <chrono>
+
+BatchRunner::BatchRunner(const char *rom_path, size_t instances, unsigned threads, const BusOptions &options)
+    : BatchRunner(RomImage::load(rom_path), instances, threads, options) {}
+
+BatchRunner::BatchRunner(std::shared_ptr<const RomImage> rom, size_t instances, unsigned threads, const BusOptions &options) : pool(threads) {
+    consoles.reserve(instances);
+    for (size_t i = 0; i < instances; ++i) {
+        consoles.emplace_back(new Bus(rom, options));
+        consoles.back()->cpu.reset();
+    }
+    worker_frames.resize(pool.size());
+}
+
+void BatchRunner::run_frame_task(void *context, size_t index, unsigned worker) {
+    BatchRunner *runner = static_cast<BatchRunner*>(context);
+    runner->consoles[index]->run_frame();
+    runner->worker_frames[worker].frames++;
+}
+
+void BatchRunner::run_frame() {
+    auto start = std::chrono::steady_clock::now();
+    pool.parallel_for(consoles.size(), &BatchRunner::run_frame_task, this);
+    wall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    frames += consoles.size();
+}
+
+BatchStats BatchRunner::stats() const {
+    BatchStats stats;
+    stats.frames = frames;
+    stats.wall_seconds = wall_seconds;
+    stats.frames_per_second = wall_seconds > 0.0 ? frames / wall_seconds : 0.0;
+
+    for (unsigned worker = 0; worker < pool.size(); ++worker) {
+        double busy = pool.busy_seconds(worker);
+        stats.worker_frames_per_second.push_back(busy > 0.0 ? worker_frames[worker].frames / busy : 0.0);
+    }
+    return stats;
+}
+
+void BatchRunner::reset_stats() {
+    frames = 0;
+    wall_seconds = 0.0;
+    for (WorkerCounter &counter : worker_frames) {
+        counter.frames = 0;
+    }
+    pool.reset_busy_time();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "../bus/bus.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct BatchStats {
+    // Console-frames emulated and wall time spent in run_frame() since the last reset.
+    uint64_t frames = 0;
+    double wall_seconds = 0.0;
+    double frames_per_second = 0.0;
+
+    // Frames per second of busy time for each worker thread (one per core).
+    std::vector<double> worker_frames_per_second;
+};
+
+// Owns a set of independent consoles and advances all of them one frame per
+// run_frame() call, spread across a work-stealing thread pool.
+class BatchRunner {
+public:
+    // threads == 0 uses one worker per hardware thread.
+    // The ROM is loaded once and shared read-only by every console.
+    BatchRunner(const char *rom_path, size_t instances, unsigned threads = 0, const BusOptions &options = BusOptions());
+    BatchRunner(std::shared_ptr<const RomImage> rom, size_t instances, unsigned threads = 0, const BusOptions &options = BusOptions());
+
+    size_t size() const { return consoles.size(); }
+    Bus &console(size_t index) { return *consoles[index]; }
+    unsigned thread_count() const { return pool.size(); }
+
+    // Advances every console by one frame.
+    void run_frame();
+
+    // Runs task(context, console_index, worker) for every console on the pool.
+    void for_each(ThreadPool::Task task, void *context) { pool.parallel_for(consoles.size(), task, context); }
+
+    // Last completed frame (256x240 0xRRGGBB) and 2KB internal RAM of a console.
+    const uint32_t *framebuffer(size_t index) const { return consoles[index]->ppu.framebuffer; }
+    const uint8_t *ram(size_t index) const { return consoles[index]->ram; }
+
+    BatchStats stats() const;
+    void reset_stats();
+
+private:
+    struct alignas(64) WorkerCounter {
+        uint64_t frames = 0;
+    };
+
+    static void run_frame_task(void *context, size_t index, unsigned worker);
+
+    std::vector<std::unique_ptr<Bus>> consoles;
+    ThreadPool pool;
+    std::vector<WorkerCounter> worker_frames;
+
+    uint64_t frames = 0;
+    double wall_seconds = 0.0;
+};
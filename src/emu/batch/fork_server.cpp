@@ -0,0 +1,220 @@
+#include "fork_server.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Request {
+    uint32_t frames;
+    uint8_t want_framebuffer;
+};
+
+bool read_full(int fd, void *data, size_t size) {
+    uint8_t *bytes = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool write_full(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+uint64_t fnv1a(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::runtime_error system_error(const char *what) {
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+}
+
+ForkServer::ForkServer(const Bus &parent, size_t count) {
+    // A worker that died leaves its request pipe without a reader. Ignore
+    // SIGPIPE so submit() sees EPIPE and throws instead of killing the parent.
+    signal(SIGPIPE, SIG_IGN);
+
+    results_size = sizeof(ForkResult) * count;
+    void *shared = mmap(nullptr, results_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        throw system_error("Failed to map fork server results");
+    }
+    results = static_cast<ForkResult*>(shared);
+
+    workers.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        int request_pipe[2];
+        int done_pipe[2];
+        if (pipe(request_pipe) != 0) {
+            shutdown();
+            throw system_error("Failed to create worker pipe");
+        }
+        if (pipe(done_pipe) != 0) {
+            close(request_pipe[0]);
+            close(request_pipe[1]);
+            shutdown();
+            throw system_error("Failed to create worker pipe");
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(request_pipe[0]);
+            close(request_pipe[1]);
+            close(done_pipe[0]);
+            close(done_pipe[1]);
+            shutdown();
+            throw system_error("Failed to fork worker");
+        }
+
+        if (pid == 0) {
+            // Drop the parent's ends of every earlier worker's pipes, otherwise
+            // those workers would never see EOF when the server shuts down.
+            for (size_t j = 0; j < i; ++j) {
+                close(workers[j].request_fd);
+                close(workers[j].done_fd);
+            }
+            close(request_pipe[1]);
+            close(done_pipe[0]);
+            try {
+                worker_main(parent, request_pipe[0], done_pipe[1], &results[i]);
+            } catch (...) {
+                _exit(1);
+            }
+            _exit(0);
+        }
+
+        close(request_pipe[0]);
+        close(done_pipe[1]);
+        workers[i].pid = pid;
+        workers[i].request_fd = request_pipe[1];
+        workers[i].done_fd = done_pipe[0];
+    }
+}
+
+ForkServer::~ForkServer() {
+    shutdown();
+}
+
+void ForkServer::worker_main(const Bus &parent, int request_fd, int done_fd, ForkResult *result) {
+    // `parent` is this process's copy-on-write snapshot of the fork point and
+    // is never modified, so each script restarts from it with copy_state().
+    std::unique_ptr<Bus> bus = parent.clone(false);
+    std::vector<uint8_t> inputs;
+    Request request;
+
+    while (read_full(request_fd, &request, sizeof(request))) {
+        inputs.resize(request.frames);
+        if (!read_full(request_fd, inputs.data(), inputs.size())) {
+            break;
+        }
+
+        bus->copy_state(parent, false);
+        // Only the final frame is hashed/returned, so skip drawing the rest.
+        for (uint32_t frame = 0; frame < request.frames; ++frame) {
+            bus->set_controller_state(0, inputs[frame]);
+            bus->run_frame(frame + 1 == request.frames);
+        }
+
+        result->frames = request.frames;
+        result->frame_hash = fnv1a(bus->ppu.framebuffer, sizeof(bus->ppu.framebuffer));
+        std::memcpy(result->ram, bus->ram, ForkResult::RAM_SIZE);
+        if (request.want_framebuffer) {
+            std::memcpy(result->framebuffer, bus->ppu.framebuffer, sizeof(result->framebuffer));
+        }
+
+        uint8_t done = 1;
+        if (!write_full(done_fd, &done, sizeof(done))) {
+            break;
+        }
+    }
+
+    close(request_fd);
+    close(done_fd);
+}
+
+void ForkServer::submit(size_t worker, const uint8_t *inputs, uint32_t frames, bool want_framebuffer) {
+    Worker &w = workers.at(worker);
+    if (w.busy) {
+        wait(worker);
+    }
+
+    Request request { frames, static_cast<uint8_t>(want_framebuffer ? 1 : 0) };
+    if (!write_full(w.request_fd, &request, sizeof(request)) || !write_full(w.request_fd, inputs, frames)) {
+        throw system_error("Failed to send script to fork worker");
+    }
+    w.busy = true;
+}
+
+const ForkResult &ForkServer::wait(size_t worker) {
+    Worker &w = workers.at(worker);
+    if (w.busy) {
+        uint8_t done = 0;
+        if (!read_full(w.done_fd, &done, sizeof(done))) {
+            throw std::runtime_error("Fork worker " + std::to_string(worker) + " exited unexpectedly");
+        }
+        w.busy = false;
+    }
+    return results[worker];
+}
+
+void ForkServer::shutdown() {
+    // Closing the request pipe makes the worker's read() return EOF.
+    for (Worker &w : workers) {
+        if (w.request_fd >= 0) {
+            close(w.request_fd);
+            w.request_fd = -1;
+        }
+    }
+    for (Worker &w : workers) {
+        if (w.pid > 0) {
+            waitpid(w.pid, nullptr, 0);
+            w.pid = -1;
+        }
+        if (w.done_fd >= 0) {
+            close(w.done_fd);
+            w.done_fd = -1;
+        }
+    }
+    workers.clear();
+
+    if (results) {
+        munmap(results, results_size);
+        results = nullptr;
+    }
+}
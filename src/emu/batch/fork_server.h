@@ -0,0 +1,62 @@
+#pragma once
+
+#include "../bus/bus.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+// Result block a worker fills in for each script. Lives in memory shared
+// between the parent and its workers, so nothing is serialized back.
+struct ForkResult {
+    static constexpr size_t RAM_SIZE = 0x0800;
+    static constexpr size_t FRAMEBUFFER_PIXELS = 256 * 240;
+
+    uint32_t frames;          // frames actually run
+    uint64_t frame_hash;      // FNV-1a of the final framebuffer
+    uint8_t ram[RAM_SIZE];
+    uint32_t framebuffer[FRAMEBUFFER_PIXELS];  // only written when requested
+};
+
+// Forks worker processes from a warmed-up console. Each worker starts as a
+// copy-on-write image of the parent, so the ROM, PPU tables and every page the
+// branch never touches stay shared. Scripts (one controller byte per frame) go
+// to a worker over a pipe; every script starts again from the fork-point state.
+//
+// POSIX only. Fork before starting any other threads in the parent. The
+// constructor sets SIGPIPE to SIG_IGN for the whole process, so a worker that
+// died shows up as an exception from submit() or wait().
+class ForkServer {
+public:
+    ForkServer(const Bus &parent, size_t workers);
+    ~ForkServer();
+
+    ForkServer(const ForkServer&) = delete;
+    ForkServer& operator=(const ForkServer&) = delete;
+
+    size_t size() const { return workers.size(); }
+    pid_t pid(size_t worker) const { return workers.at(worker).pid; }
+
+    // Starts a script on a worker. inputs holds `frames` controller-1 bytes
+    // (Bus::ControllerButton layout), one per frame.
+    void submit(size_t worker, const uint8_t *inputs, uint32_t frames, bool want_framebuffer = false);
+
+    // Blocks until the worker's current script has finished and returns its result.
+    const ForkResult &wait(size_t worker);
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int request_fd = -1;
+        int done_fd = -1;
+        bool busy = false;
+    };
+
+    static void worker_main(const Bus &parent, int request_fd, int done_fd, ForkResult *result);
+    void shutdown();
+
+    std::vector<Worker> workers;
+    ForkResult *results = nullptr;
+    size_t results_size = 0;
+};
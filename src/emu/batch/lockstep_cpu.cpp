@@ -0,0 +1,750 @@
+#include "lockstep_cpu.h"
+#include "../CPU/opcodes.h"
+#include "../cartridge/rom_image.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+// Gathers use AVX2 where the host has it, checked at run time, so one build
+// runs on any x86-64 CPU.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define LOCKSTEP_AVX2 1
+#include <immintrin.h>
+#endif
+
+// The per-lane loops below are written as plain loops over fixed-size arrays
+// with masks of 0 / 0xff so that the compiler turns them into vector code.
+#define FOR_LANES for (int l = 0; l < Lanes; ++l)
+
+#ifdef LOCKSTEP_AVX2
+// Eight lanes at a time: 32-bit gathers at each lane's byte, keeping the low
+// byte. ram is padded so the last row's gathers stay inside it.
+__attribute__((target("avx2")))
+static void gather_avx2(const uint8_t *ram, size_t ram_size, int lanes, const uint16_t *addresses, uint8_t *values)
+{
+    const __m256i offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i wrap = _mm256_set1_epi32(static_cast<int>(ram_size - 1));
+    const __m256i stride = _mm256_set1_epi32(lanes);
+    for (int group = 0; group < lanes; group += 8) {
+        __m256i addr = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(addresses + group)));
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(addr, wrap), stride),
+                                         _mm256_add_epi32(offsets, _mm256_set1_epi32(group)));
+        __m256i words = _mm256_i32gather_epi32(reinterpret_cast<const int*>(ram), index, 1);
+        alignas(32) uint32_t gathered[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(gathered), words);
+        for (int l = 0; l < 8; ++l)
+            values[group + l] = static_cast<uint8_t>(gathered[l]);
+    }
+}
+#endif
+
+static bool host_has_avx2()
+{
+#ifdef LOCKSTEP_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+template<int Lanes>
+LockstepCPU<Lanes>::LockstepCPU(std::shared_ptr<const RomImage> rom)
+    : image(std::move(rom)), ram(new uint8_t[RAM_SIZE * Lanes + 4]()), avx2(host_has_avx2())
+{
+    if (image->mapper_id() != 0 || (image->prg_size() != 0x4000 && image->prg_size() != 0x8000))
+        throw std::runtime_error("Lockstep CPU needs an NROM (mapper 0) ROM");
+    prg = image->prg();
+    prg_mask = static_cast<uint16_t>(image->prg_size() - 1);
+    reset();
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::reset()
+{
+    uint16_t start = rom(0xfffc) | rom(0xfffd) << 8;
+    FOR_LANES {
+        pc[l] = start;
+        a[l] = x[l] = y[l] = 0;
+        sp[l] = 0xfd;
+        flags[l] = 0x04;
+        carry[l] = overflow[l] = negative_result[l] = 0;
+        zero_result[l] = 1;
+        cycles[l] = 0;
+        halted[l] = 0;
+    }
+    std::memset(ram.get(), 0, RAM_SIZE * Lanes);
+    converged = diverged = 0;
+}
+
+template<int Lanes>
+CPURegisters LockstepCPU<Lanes>::get_regs(int lane) const
+{
+    CPURegisters regs{};
+    regs.pc = pc[lane];
+    regs.a = a[lane];
+    regs.x = x[lane];
+    regs.y = y[lane];
+    regs.sp = sp[lane];
+    regs.status = get_flags(lane).all;
+    return regs;
+}
+
+template<int Lanes>
+CPUFlags LockstepCPU<Lanes>::get_flags(int lane) const
+{
+    uint8_t values[Lanes];
+    status_byte(values);
+    CPUFlags current;
+    current.all = values[lane];
+    return current;
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::run(uint64_t target)
+{
+    for (;;) {
+        Mask active;
+        uint64_t least = UINT64_MAX;
+        FOR_LANES {
+            active[l] = (!halted[l] && cycles[l] < target) ? 0xff : 0;
+            uint64_t at = active[l] ? cycles[l] : UINT64_MAX;
+            least = at < least ? at : least;
+        }
+        if (least == UINT64_MAX)
+            return;
+
+        Mask mask;
+        int behind = 0;
+        while (!active[behind] || cycles[behind] != least)
+            ++behind;
+        uint16_t address = pc[behind];
+        int running = 0, taking_part = 0;
+        FOR_LANES {
+            mask[l] = active[l] & (pc[l] == address ? 0xff : 0);
+            running += active[l] & 1;
+            taking_part += mask[l] & 1;
+        }
+        if (taking_part == running)
+            ++converged;
+        else
+            ++diverged;
+        step(address, mask);
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::stop(Mask mask, const Mask which)
+{
+    FOR_LANES {
+        halted[l] |= which[l];
+        mask[l] &= ~which[l];
+    }
+}
+
+template<int Lanes>
+typename LockstepCPU<Lanes>::Operand LockstepCPU<Lanes>::fixed(uint16_t addr) const
+{
+    Operand operand;
+    operand.address = addr;
+    if (addr < 0x2000) {
+        operand.kind = Operand::Row;
+        operand.address = addr & (RAM_SIZE - 1);
+    } else if (addr >= 0x8000) {
+        operand.kind = Operand::Rom;
+    } else {
+        operand.kind = Operand::Elsewhere;
+    }
+    return operand;
+}
+
+template<int Lanes>
+bool LockstepCPU<Lanes>::resolve(Operand &operand, Mask mask, bool store)
+{
+    Mask outside;
+    switch (operand.kind) {
+    case Operand::Value:
+    case Operand::Row:
+        return true;
+    case Operand::Rom:
+        if (!store)
+            return true;
+        stop(mask, mask);
+        return false;
+    case Operand::Elsewhere:
+        stop(mask, mask);
+        return false;
+    case Operand::PerLane:
+        break;
+    }
+
+    uint8_t left = 0;
+    FOR_LANES {
+        uint16_t addr = operand.lanes[l];
+        bool reachable = addr < 0x2000 || (!store && addr >= 0x8000);
+        outside[l] = mask[l] & (reachable ? 0 : 0xff);
+        left |= mask[l] & ~outside[l];
+    }
+    stop(mask, outside);
+    return left != 0;
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::gather(const uint16_t *addresses, uint8_t *values) const
+{
+#ifdef LOCKSTEP_AVX2
+    if (avx2) {
+        gather_avx2(ram.get(), RAM_SIZE, Lanes, addresses, values);
+        return;
+    }
+#endif
+    FOR_LANES {
+        values[l] = ram[(addresses[l] & (RAM_SIZE - 1)) * Lanes + l];
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::load(const Operand &operand, const Mask mask, uint8_t *values) const
+{
+    switch (operand.kind) {
+    case Operand::Value:
+        std::memset(values, operand.address, Lanes);
+        return;
+    case Operand::Row:
+        std::memcpy(values, &ram[operand.address * Lanes], Lanes);
+        return;
+    case Operand::Rom:
+        std::memset(values, rom(operand.address), Lanes);
+        return;
+    case Operand::PerLane:
+        break;
+    case Operand::Elsewhere:
+        return;
+    }
+
+    uint8_t in_rom = 0;
+    FOR_LANES {
+        in_rom |= mask[l] & (operand.lanes[l] >= 0x8000 ? 0xff : 0);
+    }
+    gather(operand.lanes, values);
+    if (in_rom) {
+        FOR_LANES {
+            if (operand.lanes[l] >= 0x8000)
+                values[l] = rom(operand.lanes[l]);
+        }
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::store(const Operand &operand, const Mask mask, const uint8_t *values)
+{
+    if (operand.kind == Operand::Row) {
+        uint8_t *row = &ram[operand.address * Lanes];
+        FOR_LANES {
+            row[l] = (values[l] & mask[l]) | (row[l] & ~mask[l]);
+        }
+        return;
+    }
+    // No scatter instruction in AVX2; lanes write one by one.
+    FOR_LANES {
+        if (mask[l])
+            ram[(operand.lanes[l] & (RAM_SIZE - 1)) * Lanes + l] = values[l];
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::push(const Mask mask, const uint8_t *values)
+{
+    FOR_LANES {
+        if (mask[l])
+            ram[(0x100 | sp[l]) * Lanes + l] = values[l];
+        sp[l] -= mask[l] & 1;
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::pop(const Mask mask, uint8_t *values)
+{
+    FOR_LANES {
+        sp[l] += mask[l] & 1;
+        values[l] = ram[(0x100 | sp[l]) * Lanes + l];
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::set_zn(const Mask mask, const uint8_t *values)
+{
+    FOR_LANES {
+        zero_result[l] = (values[l] & mask[l]) | (zero_result[l] & ~mask[l]);
+        negative_result[l] = (values[l] & mask[l]) | (negative_result[l] & ~mask[l]);
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::set_status(const Mask mask, const uint8_t *values)
+{
+    FOR_LANES {
+        uint8_t m = mask[l];
+        uint8_t v = values[l];
+        flags[l] = (v & m) | (flags[l] & ~m);
+        carry[l] = ((v & 1) & m) | (carry[l] & ~m);
+        overflow[l] = (((v >> 6) & 1) & m) | (overflow[l] & ~m);
+        zero_result[l] = (((v & 2) ? 0 : 1) & m) | (zero_result[l] & ~m);
+        negative_result[l] = ((v & 0x80) & m) | (negative_result[l] & ~m);
+    }
+}
+
+template<int Lanes>
+void LockstepCPU<Lanes>::status_byte(uint8_t *values) const
+{
+    FOR_LANES {
+        values[l] = (flags[l] & 0x3c) | carry[l] | (zero_result[l] ? 0 : 0x02) |
+                    overflow[l] << 6 | (negative_result[l] & 0x80);
+    }
+}
+
+// One instruction, the one at `address`, for the lanes in mask. Mirrors the
+// scalar CPU's execute() case for case.
+template<int Lanes>
+void LockstepCPU<Lanes>::step(uint16_t address, Mask mask)
+{
+    uint8_t opcode = rom(address);
+    InstructionGroup group = instruction_group(opcode);
+    int length = instruction_length(opcode);
+    if (address < 0x8000 || group == InstructionGroup::Unknown || address + length > 0x10000) {
+        stop(mask, mask);
+        return;
+    }
+
+    uint8_t lo = length > 1 ? rom(address + 1) : 0;
+    uint16_t word = lo | (length > 2 ? rom(address + 2) << 8 : 0);
+    uint16_t next = address + length;
+    int mode = (opcode & AddrModeMask) >> AddrModeShift;
+    int op = (opcode & OperationMask) >> OperationShift;
+
+    // Work out where the operand is before anything changes, so that lanes
+    // which can't execute the instruction stop in front of it.
+    Operand operand;
+    uint8_t page_crossed[Lanes] = {};
+    auto indexed = [&](uint16_t base, const uint8_t *index, bool zero_page, bool penalty) {
+        operand.kind = Operand::PerLane;
+        FOR_LANES {
+            uint16_t addr = base + index[l];
+            operand.lanes[l] = zero_page ? (addr & 0xff) : addr;
+            page_crossed[l] = penalty && ((base ^ addr) & 0xff00) ? 1 : 0;
+        }
+    };
+    auto indirect = [&](const uint16_t *pointers, const uint8_t *index, bool penalty) {
+        uint8_t low[Lanes], high[Lanes];
+        uint16_t next_pointers[Lanes];
+        FOR_LANES {
+            next_pointers[l] = (pointers[l] + 1) & 0xff;
+        }
+        gather(pointers, low);
+        gather(next_pointers, high);
+        operand.kind = Operand::PerLane;
+        FOR_LANES {
+            uint16_t base = low[l] | high[l] << 8;
+            uint16_t addr = base + (index ? index[l] : 0);
+            operand.lanes[l] = addr;
+            page_crossed[l] = penalty && ((base ^ addr) & 0xff00) ? 1 : 0;
+        }
+    };
+
+    bool has_operand = false;
+    bool writes = false;
+    switch (group) {
+    case InstructionGroup::Type1: {
+        bool is_store = op == STA;
+        has_operand = true;
+        writes = is_store;
+        switch (mode) {
+        case IndexedIndirectX: {
+            uint16_t pointers[Lanes];
+            FOR_LANES {
+                pointers[l] = (lo + x[l]) & 0xff;
+            }
+            indirect(pointers, nullptr, false);
+            break;
+        }
+        case ZeroPage:
+            operand = fixed(lo);
+            break;
+        case Immediate:
+            operand.address = lo;
+            break;
+        case Absolute:
+            operand = fixed(word);
+            break;
+        case IndirectY: {
+            uint16_t pointers[Lanes];
+            FOR_LANES {
+                pointers[l] = lo;
+            }
+            indirect(pointers, y, !is_store);
+            break;
+        }
+        case IndexedX:
+            indexed(lo, x, true, false);
+            break;
+        case AbsoluteY:
+            indexed(word, y, false, !is_store);
+            break;
+        case AbsoluteX:
+            indexed(word, x, false, !is_store);
+            break;
+        }
+        break;
+    }
+    case InstructionGroup::Type2:
+    case InstructionGroup::Type0: {
+        bool type2 = group == InstructionGroup::Type2;
+        const uint8_t *index = (type2 && (op == LDX || op == STX)) ? y : x;
+        has_operand = !(type2 && mode == Addr_Accumulator);
+        writes = type2 ? (op != LDX) : (op == STY);
+        switch (mode) {
+        case Addr_Immediate:
+            operand.address = lo;
+            break;
+        case Addr_ZeroPage:
+            operand = fixed(lo);
+            break;
+        case Addr_Absolute:
+            operand = fixed(word);
+            break;
+        case Addr_Indexed:
+            indexed(lo, index, true, false);
+            break;
+        case Addr_AbsoluteIndexed:
+            indexed(word, index, false, true);
+            break;
+        }
+        break;
+    }
+    case InstructionGroup::Implied:
+        if (opcode == JMPI) {
+            // Both bytes of the vector lie in the same page.
+            operand = fixed(word);
+            has_operand = true;
+        }
+        break;
+    default:
+        break;
+    }
+    if (has_operand && !resolve(operand, mask, writes))
+        return;
+
+    FOR_LANES {
+        pc[l] = mask[l] ? next : pc[l];
+        cycles[l] += (mask[l] ? OperationCycles[opcode] : 0) + (page_crossed[l] & mask[l]);
+    }
+
+    uint8_t value[Lanes];
+    uint8_t result[Lanes];
+    auto assign = [&](uint8_t *reg, const uint8_t *values) {
+        FOR_LANES {
+            reg[l] = (values[l] & mask[l]) | (reg[l] & ~mask[l]);
+        }
+    };
+    auto compare = [&](const uint8_t *reg) {
+        load(operand, mask, value);
+        FOR_LANES {
+            uint16_t diff = reg[l] - value[l];
+            result[l] = static_cast<uint8_t>(diff);
+            value[l] = (diff & 0x100) ? 0 : 1;
+        }
+        assign(carry, value);
+        set_zn(mask, result);
+    };
+
+    switch (group) {
+    case InstructionGroup::Implied:
+        switch (opcode) {
+        case NOP:
+            break;
+        case BRK: {
+            uint16_t vector = rom(0xfffe) | rom(0xffff) << 8;
+            FOR_LANES {
+                value[l] = static_cast<uint8_t>((address + 2) >> 8);
+                result[l] = static_cast<uint8_t>(address + 2);
+            }
+            push(mask, value);
+            push(mask, result);
+            FOR_LANES {
+                flags[l] |= mask[l] & 0x10;
+            }
+            status_byte(value);
+            push(mask, value);
+            FOR_LANES {
+                flags[l] |= mask[l] & 0x04;
+                pc[l] = mask[l] ? vector : pc[l];
+                // The interrupt sequence's own 7 cycles.
+                cycles[l] += mask[l] & 7;
+            }
+            break;
+        }
+        case JSR:
+            FOR_LANES {
+                value[l] = static_cast<uint8_t>((next - 1) >> 8);
+                result[l] = static_cast<uint8_t>(next - 1);
+            }
+            push(mask, value);
+            push(mask, result);
+            FOR_LANES {
+                pc[l] = mask[l] ? word : pc[l];
+            }
+            break;
+        case RTS:
+            pop(mask, result);
+            pop(mask, value);
+            FOR_LANES {
+                pc[l] = mask[l] ? static_cast<uint16_t>((result[l] | value[l] << 8) + 1) : pc[l];
+            }
+            break;
+        case RTI:
+            pop(mask, value);
+            set_status(mask, value);
+            pop(mask, result);
+            pop(mask, value);
+            FOR_LANES {
+                pc[l] = mask[l] ? static_cast<uint16_t>(result[l] | value[l] << 8) : pc[l];
+            }
+            break;
+        case JMP:
+            FOR_LANES {
+                pc[l] = mask[l] ? word : pc[l];
+            }
+            break;
+        case JMPI: {
+            // The 6502 fetches the high byte from the start of the same page
+            // when the vector straddles a page boundary.
+            Operand high = fixed((word & 0xff00) | ((word + 1) & 0xff));
+            load(operand, mask, result);
+            load(high, mask, value);
+            FOR_LANES {
+                pc[l] = mask[l] ? static_cast<uint16_t>(result[l] | value[l] << 8) : pc[l];
+            }
+            break;
+        }
+        case PHP:
+            status_byte(value);
+            push(mask, value);
+            break;
+        case PLP:
+            pop(mask, value);
+            set_status(mask, value);
+            break;
+        case PHA:
+            push(mask, a);
+            break;
+        case PLA:
+            pop(mask, value);
+            assign(a, value);
+            set_zn(mask, value);
+            break;
+        case DEY:
+        case INY:
+        case DEX:
+        case INX: {
+            uint8_t *reg = (opcode == DEY || opcode == INY) ? y : x;
+            uint8_t delta = (opcode == DEY || opcode == DEX) ? 0xff : 1;
+            FOR_LANES {
+                value[l] = reg[l] + delta;
+            }
+            assign(reg, value);
+            set_zn(mask, value);
+            break;
+        }
+        case TAY:
+            assign(y, a);
+            set_zn(mask, a);
+            break;
+        case TYA:
+            assign(a, y);
+            set_zn(mask, a);
+            break;
+        case TXA:
+            assign(a, x);
+            set_zn(mask, a);
+            break;
+        case TAX:
+            assign(x, a);
+            set_zn(mask, x);
+            break;
+        case TSX:
+            assign(x, sp);
+            set_zn(mask, x);
+            break;
+        case TXS:
+            assign(sp, x);
+            break;
+        case CLC:
+        case SEC:
+            std::memset(value, opcode == SEC, Lanes);
+            assign(carry, value);
+            break;
+        case CLV:
+            std::memset(value, 0, Lanes);
+            assign(overflow, value);
+            break;
+        case CLI:
+        case SEI:
+        case CLD:
+        case SED: {
+            uint8_t bit = (opcode == CLI || opcode == SEI) ? 0x04 : 0x08;
+            bool set = opcode == SEI || opcode == SED;
+            FOR_LANES {
+                value[l] = set ? (flags[l] | bit) : (flags[l] & ~bit);
+            }
+            assign(flags, value);
+            break;
+        }
+        }
+        break;
+
+    case InstructionGroup::Branch: {
+        bool wanted = opcode & BranchConditionMask;
+        uint16_t target = next + static_cast<int8_t>(lo);
+        uint8_t extra = 1 + (((next ^ target) & 0xff00) ? 1 : 0);
+        FOR_LANES {
+            bool flag = false;
+            switch (opcode >> BranchOnFlagShift) {
+            case Negative: flag = (negative_result[l] & 0x80) != 0; break;
+            case Overflow: flag = overflow[l] != 0; break;
+            case Carry:    flag = carry[l] != 0; break;
+            case Zero:     flag = zero_result[l] == 0; break;
+            }
+            uint8_t taken = mask[l] & ((flag == wanted) ? 0xff : 0);
+            pc[l] = taken ? target : pc[l];
+            cycles[l] += taken & extra;
+        }
+        break;
+    }
+
+    case InstructionGroup::Type1:
+        if (op == STA) {
+            store(operand, mask, a);
+            break;
+        }
+        if (op == CMP) {
+            compare(a);
+            break;
+        }
+        load(operand, mask, value);
+        switch (op) {
+        case ORA:
+            FOR_LANES { result[l] = a[l] | value[l]; }
+            break;
+        case AND:
+            FOR_LANES { result[l] = a[l] & value[l]; }
+            break;
+        case EOR:
+            FOR_LANES { result[l] = a[l] ^ value[l]; }
+            break;
+        case LDA:
+            std::memcpy(result, value, Lanes);
+            break;
+        case ADC:
+        case SBC: {
+            uint8_t carries[Lanes], overflows[Lanes];
+            FOR_LANES {
+                uint8_t operand_value = op == SBC ? static_cast<uint8_t>(~value[l]) : value[l];
+                uint16_t sum = a[l] + operand_value + carry[l];
+                carries[l] = (sum & 0x100) ? 1 : 0;
+                overflows[l] = ((a[l] ^ sum) & (operand_value ^ sum) & 0x80) ? 1 : 0;
+                result[l] = static_cast<uint8_t>(sum);
+            }
+            assign(carry, carries);
+            assign(overflow, overflows);
+            break;
+        }
+        }
+        assign(a, result);
+        set_zn(mask, result);
+        break;
+
+    case InstructionGroup::Type2:
+        switch (op) {
+        case STX:
+            store(operand, mask, x);
+            break;
+        case LDX:
+            load(operand, mask, value);
+            assign(x, value);
+            set_zn(mask, value);
+            break;
+        case DEC:
+        case INC:
+            load(operand, mask, value);
+            FOR_LANES {
+                result[l] = value[l] + (op == INC ? 1 : 0xff);
+            }
+            set_zn(mask, result);
+            store(operand, mask, result);
+            break;
+        default: {
+            // ASL, ROL, LSR, ROR on A or memory.
+            bool left = op == ASL || op == ROL;
+            bool rotate = op == ROL || op == ROR;
+            if (has_operand)
+                load(operand, mask, value);
+            else
+                std::memcpy(value, a, Lanes);
+            uint8_t carries[Lanes];
+            FOR_LANES {
+                uint8_t in = rotate ? carry[l] : 0;
+                carries[l] = left ? (value[l] >> 7) : (value[l] & 1);
+                result[l] = left ? static_cast<uint8_t>(value[l] << 1 | in) : static_cast<uint8_t>(value[l] >> 1 | in << 7);
+            }
+            assign(carry, carries);
+            set_zn(mask, result);
+            if (has_operand)
+                store(operand, mask, result);
+            else
+                assign(a, result);
+            break;
+        }
+        }
+        break;
+
+    case InstructionGroup::Type0:
+        switch (op) {
+        case BIT: {
+            load(operand, mask, value);
+            uint8_t overflows[Lanes];
+            FOR_LANES {
+                result[l] = a[l] & value[l];
+                overflows[l] = (value[l] >> 6) & 1;
+            }
+            assign(zero_result, result);
+            assign(overflow, overflows);
+            assign(negative_result, value);
+            break;
+        }
+        case STY:
+            store(operand, mask, y);
+            break;
+        case LDY:
+            load(operand, mask, value);
+            assign(y, value);
+            set_zn(mask, value);
+            break;
+        case CPY:
+            compare(y);
+            break;
+        case CPX:
+            compare(x);
+            break;
+        }
+        break;
+
+    case InstructionGroup::Unknown:
+        break;
+    }
+}
+
+#undef FOR_LANES
+
+template class LockstepCPU<8>;
+template class LockstepCPU<16>;
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "src/emu/CPU/CPU.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class RomImage;
+
+// Experimental: the CPUs of Lanes consoles running the same NROM program,
+// executed in lockstep. Registers and flags are kept structure-of-arrays (one
+// array per CPURegisters / CPUFlags field, one element per lane) and the
+// lanes' internal RAM is interleaved, byte n of every lane side by side, so
+// an instruction executed by all lanes at once works on whole rows: a zero
+// page or absolute operand is one contiguous load or store, and indexed
+// operands are gathered (with AVX2 when the host has it).
+//
+// Each step executes the instruction at the PC of the lane furthest behind
+// in cycles, for every lane at that PC. Lanes that branched elsewhere wait
+// their turn, and join in again as soon as they reach the same PC. Results
+// are identical to the scalar CPU class, cycle counts included.
+//
+// Only the CPU is modelled. A lane stops, before executing it, at the first
+// instruction that would need the rest of the console: code outside PRG ROM,
+// any access to $2000-$7FFF, a write to $8000-$FFFF, or an unknown opcode.
+// There are no interrupts other than BRK.
+template<int Lanes>
+class LockstepCPU {
+public:
+    static_assert(Lanes > 0 && Lanes % 8 == 0, "lanes come in groups of 8");
+    static constexpr size_t RAM_SIZE = 0x0800;
+
+    // Throws std::runtime_error unless rom uses mapper 0.
+    explicit LockstepCPU(std::shared_ptr<const RomImage> rom);
+
+    LockstepCPU(const LockstepCPU&) = delete;
+    LockstepCPU& operator=(const LockstepCPU&) = delete;
+
+    // Every lane as after CPU::reset() on a fresh console. RAM is cleared.
+    void reset();
+
+    // Runs every lane until it has run at least `cycles` CPU cycles since
+    // reset (so it ends on the same instruction as CPU::step() would), or has
+    // stopped.
+    void run(uint64_t cycles);
+
+    CPURegisters get_regs(int lane) const;
+    CPUFlags get_flags(int lane) const;
+    uint64_t get_cycles(int lane) const { return cycles[lane]; }
+    bool stopped(int lane) const { return halted[lane] != 0; }
+
+    uint8_t read_ram(int lane, uint16_t addr) const { return ram[(addr & (RAM_SIZE - 1)) * Lanes + lane]; }
+    void write_ram(int lane, uint16_t addr, uint8_t value) { ram[(addr & (RAM_SIZE - 1)) * Lanes + lane] = value; }
+
+    // Instructions executed with every running lane at once, and with only
+    // some of them.
+    uint64_t converged_steps() const { return converged; }
+    uint64_t diverged_steps() const { return diverged; }
+    // Whether gathers run as AVX2 code on this host rather than as a scalar
+    // loop.
+    bool uses_avx2() const { return avx2; }
+
+private:
+    // One byte per lane: 0xff where the lane takes part, 0 where it doesn't.
+    using Mask = uint8_t[Lanes];
+
+    // Where an instruction's operand is, as seen by the lanes executing it.
+    struct Operand {
+        enum Kind { Value, Row, Rom, PerLane, Elsewhere } kind = Value;
+        uint16_t address = 0;       // Value: the operand; Row: RAM offset; Rom, Elsewhere: CPU address
+        uint16_t lanes[Lanes];      // PerLane: each lane's CPU address
+    };
+
+    void step(uint16_t address, Mask mask);
+    // Stops the lanes in which and takes them out of mask.
+    void stop(Mask mask, const Mask which);
+
+    uint8_t rom(uint16_t addr) const { return prg[addr & prg_mask]; }
+    Operand fixed(uint16_t addr) const;
+    // Drops lanes whose operand isn't in internal RAM or (for loads) PRG ROM
+    // from mask, stopping them. Returns false if no lane is left.
+    bool resolve(Operand &operand, Mask mask, bool store);
+    void load(const Operand &operand, const Mask mask, uint8_t *values) const;
+    void store(const Operand &operand, const Mask mask, const uint8_t *values);
+    void gather(const uint16_t *addresses, uint8_t *values) const;
+
+    void push(const Mask mask, const uint8_t *values);
+    void pop(const Mask mask, uint8_t *values);
+    void set_zn(const Mask mask, const uint8_t *values);
+    void set_status(const Mask mask, const uint8_t *values);
+    void status_byte(uint8_t *values) const;
+
+    std::shared_ptr<const RomImage> image;
+    const uint8_t *prg = nullptr;
+    uint16_t prg_mask = 0;
+
+    alignas(32) uint16_t pc[Lanes] = {};
+    alignas(32) uint8_t a[Lanes] = {};
+    alignas(32) uint8_t x[Lanes] = {};
+    alignas(32) uint8_t y[Lanes] = {};
+    alignas(32) uint8_t sp[Lanes] = {};
+    // Kept as lazily as in CPU: flags holds I, D, B and U.
+    alignas(32) uint8_t flags[Lanes] = {};
+    alignas(32) uint8_t carry[Lanes] = {};
+    alignas(32) uint8_t overflow[Lanes] = {};
+    alignas(32) uint8_t zero_result[Lanes] = {};
+    alignas(32) uint8_t negative_result[Lanes] = {};
+    alignas(32) uint64_t cycles[Lanes] = {};
+    alignas(32) uint8_t halted[Lanes] = {};
+
+    // RAM_SIZE rows of Lanes bytes, plus padding for 4-byte gathers.
+    std::unique_ptr<uint8_t[]> ram;
+    bool avx2;
+
+    uint64_t converged = 0;
+    uint64_t diverged = 0;
+};
+
+extern template class LockstepCPU<8>;
+extern template class LockstepCPU<16>;
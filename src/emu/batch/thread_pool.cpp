@@ -0,0 +1,109 @@
+#include "thread_pool.h"
+
+#include <chrono>
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    worker_count = threads ? threads : 1;
+    ranges.reset(new Range[worker_count]);
+
+    // Worker 0 is whichever thread calls parallel_for().
+    for (unsigned worker = 1; worker < worker_count; ++worker) {
+        this->threads.emplace_back(&ThreadPool::worker_loop, this, worker);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, Task task, void *context) {
+    if (count == 0) {
+        return;
+    }
+
+    for (unsigned worker = 0; worker < worker_count; ++worker) {
+        size_t begin = count * worker / worker_count;
+        ranges[worker].next.store(begin, std::memory_order_relaxed);
+        ranges[worker].end = count * (worker + 1) / worker_count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = task;
+        this->context = context;
+        pending = worker_count - 1;
+        ++generation;
+    }
+    wake.notify_all();
+
+    run_ranges(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+}
+
+void ThreadPool::worker_loop(unsigned worker) {
+    uint64_t seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        run_ranges(worker);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            last = --pending == 0;
+        }
+        if (last) {
+            done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_ranges(unsigned worker) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Own range first, then steal from the others in order.
+    for (unsigned offset = 0; offset < worker_count; ++offset) {
+        Range &range = ranges[(worker + offset) % worker_count];
+        for (;;) {
+            size_t index = range.next.fetch_add(1, std::memory_order_relaxed);
+            if (index >= range.end) {
+                break;
+            }
+            task(context, index, worker);
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    ranges[worker].busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+double ThreadPool::busy_seconds(unsigned worker) const {
+    return ranges[worker].busy_ns * 1e-9;
+}
+
+void ThreadPool::reset_busy_time() {
+    for (unsigned worker = 0; worker < worker_count; ++worker) {
+        ranges[worker].busy_ns = 0;
+    }
+}
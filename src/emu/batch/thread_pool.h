@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool for data-parallel loops over console instances.
+//
+// parallel_for() splits [0, count) into one contiguous range per worker. A
+// worker drains its own range first and then steals single items from the
+// other ranges, so a few slow consoles don't leave the remaining cores idle.
+// The calling thread takes part as worker 0. Dispatch uses a plain function
+// pointer and context so a parallel_for() call never allocates.
+class ThreadPool {
+public:
+    using Task = void (*)(void *context, size_t index, unsigned worker);
+
+    // threads == 0 picks std::thread::hardware_concurrency().
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Calls task(context, i, worker) for every i in [0, count) and returns once
+    // all of them have finished. Not reentrant.
+    void parallel_for(size_t count, Task task, void *context);
+
+    unsigned size() const { return worker_count; }
+
+    // Total time each worker spent inside parallel_for() bodies.
+    double busy_seconds(unsigned worker) const;
+    void reset_busy_time();
+
+private:
+    struct alignas(64) Range {
+        std::atomic<size_t> next { 0 };
+        size_t end = 0;
+        uint64_t busy_ns = 0;
+    };
+
+    void worker_loop(unsigned worker);
+    void run_ranges(unsigned worker);
+
+    unsigned worker_count;
+    std::unique_ptr<Range[]> ranges;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    unsigned pending = 0;
+    bool stopping = false;
+
+    Task task = nullptr;
+    void *context = nullptr;
+};
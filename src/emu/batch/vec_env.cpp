@@ -0,0 +1,63 @@
+#include "vec_env.h"
+
+#include <cstring>
+
+BusOptions VecEnv::default_options() {
+    BusOptions options;
+    options.audio = false;
+    return options;
+}
+
+VecEnv::VecEnv(const char *rom_path, size_t instances, unsigned threads, const BusOptions &options)
+    : runner(rom_path, instances, threads, options) {
+    if (instances > 0) {
+        pristine = runner.console(0).clone();
+    }
+}
+
+VecEnv::VecEnv(std::shared_ptr<const RomImage> rom, size_t instances, unsigned threads, const BusOptions &options)
+    : runner(std::move(rom), instances, threads, options) {
+    if (instances > 0) {
+        pristine = runner.console(0).clone();
+    }
+}
+
+void VecEnv::set_done_condition(uint16_t addr, uint8_t mask, uint8_t value) {
+    has_done_condition = true;
+    done_addr = addr & (RAM_SIZE - 1);
+    done_mask = mask;
+    done_value = value;
+}
+
+void VecEnv::step_task(void *context, size_t index, unsigned worker) {
+    const StepArgs &args = *static_cast<const StepArgs*>(context);
+    VecEnv &env = *args.env;
+    Bus &bus = env.runner.console(index);
+
+    bus.set_controller_state(0, args.actions[index]);
+
+    // Only the last frame is ever observed, and only if framebuffers were requested.
+    for (int frame = 0; frame < args.frames; ++frame) {
+        bus.run_frame(args.framebuffers && frame == args.frames - 1);
+    }
+
+    if (args.framebuffers) {
+        std::memcpy(args.framebuffers + index * FRAMEBUFFER_PIXELS, bus.ppu.framebuffer, sizeof(bus.ppu.framebuffer));
+    }
+    if (args.ram) {
+        std::memcpy(args.ram + index * RAM_SIZE, bus.ram, RAM_SIZE);
+    }
+    if (args.done) {
+        bool done = env.has_done_condition && (bus.ram[env.done_addr] & env.done_mask) == env.done_value;
+        args.done[index] = done ? 1 : 0;
+    }
+}
+
+void VecEnv::step(const uint8_t *actions, int frames, uint32_t *framebuffers, uint8_t *ram, uint8_t *done) {
+    StepArgs args { this, actions, frames, framebuffers, ram, done };
+    runner.for_each(&VecEnv::step_task, &args);
+}
+
+void VecEnv::reset(size_t index) {
+    runner.console(index).copy_state(*pristine);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "batch_runner.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Batched step API for reinforcement-learning style workloads.
+//
+// step() takes one controller byte per console (same bit layout as
+// Bus::ControllerButton), applies it to controller 1, runs every console for
+// the requested number of frames and writes the observations straight into
+// caller-owned contiguous arrays. Nothing is allocated per step.
+class VecEnv {
+public:
+    static constexpr size_t FRAMEBUFFER_PIXELS = 256 * 240;
+    static constexpr size_t RAM_SIZE = 0x0800;
+
+    // Options VecEnv builds its consoles with unless told otherwise: no audio.
+    static BusOptions default_options();
+
+    VecEnv(const char *rom_path, size_t instances, unsigned threads = 0, const BusOptions &options = default_options());
+    VecEnv(std::shared_ptr<const RomImage> rom, size_t instances, unsigned threads = 0, const BusOptions &options = default_options());
+
+    size_t size() const { return runner.size(); }
+    Bus &console(size_t index) { return runner.console(index); }
+
+    // A console reports done once (ram[addr] & mask) == value. Without a
+    // condition every console reports not done.
+    void set_done_condition(uint16_t addr, uint8_t mask, uint8_t value);
+    void clear_done_condition() { has_done_condition = false; }
+
+    // actions:      size() controller bytes
+    // framebuffers: size() * FRAMEBUFFER_PIXELS words, or nullptr to skip.
+    //               Only the last of the `frames` frames is drawn, and none
+    //               when this is nullptr.
+    // ram:          size() * RAM_SIZE bytes, or nullptr to skip
+    // done:         size() flags (0/1), or nullptr to skip
+    void step(const uint8_t *actions, int frames, uint32_t *framebuffers, uint8_t *ram, uint8_t *done);
+
+    // Power-cycles one console (e.g. after it reported done): it is restored
+    // to the state every console was built in.
+    void reset(size_t index);
+
+private:
+    struct StepArgs {
+        VecEnv *env;
+        const uint8_t *actions;
+        int frames;
+        uint32_t *framebuffers;
+        uint8_t *ram;
+        uint8_t *done;
+    };
+
+    static void step_task(void *context, size_t index, unsigned worker);
+
+    BatchRunner runner;
+    // A console as it was at power-on, never run; reset() copies it back.
+    std::unique_ptr<Bus> pristine;
+
+    bool has_done_condition = false;
+    uint16_t done_addr = 0;
+    uint8_t done_mask = 0;
+    uint8_t done_value = 0;
+};
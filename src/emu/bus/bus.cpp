@@ -1,60 +1,78 @@
 #include "bus.h"
+#include "../CPU/jit_x64.h"
+#include "../CPU/aot_module.h"
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
+#include <stdexcept>
 
-// Global pointer to the IRQ handler created for the APU. Stored at file-scope so
-// the lambda passed to the APU can reference a stable pointer to the IRQ object.
-static IRQ* g_apu_irq = nullptr;
+Bus::Bus(const char *rom_path, const BusOptions &options) : Bus(RomImage::load(rom_path), options) {}
 
-Bus::Bus(const char *rom_path) {
-    cart = load_cartridge(rom_path);
-
-    // Create the audio player first. The integer passed is the sample-rate
-    // of the audio frames the APU will push into the player's ring buffer.
-    // Choose 44100 here (matches the AudioPlayer default output rate).
-    audio_player = new AudioPlayer(44100);
-    audio_player->start();
-
-    // Prefill the audio queue with a small burst of silence so the audio callback
-    // has some headroom during startup and short scheduling hiccups. This reduces
-    // the likelihood of initial crackle caused by immediate underflow.
-    // Push ~200ms of silence as a warm-up buffer.
-    const int prefill_ms = 200;
-    const int prefill_samples = (audio_player->output_sample_rate * prefill_ms) / 1000;
-    for (int i = 0; i < prefill_samples; ++i) {
-        audio_player->audio_queue.push(0.0f);
+Bus::Bus(std::shared_ptr<const RomImage> rom, const BusOptions &options) : options(options) {
+    if (options.jit && !JitX64::supported()) {
+        throw std::runtime_error("The JIT needs an x86-64 POSIX host");
+    }
+    if (options.aot && !options.aot->matches(rom)) {
+        throw std::runtime_error("The AOT module was generated from a different ROM");
     }
+    cart = load_cartridge(std::move(rom));
 
-    // Create a persistent IRQ handler for the APU and store a pointer for callbacks.
+    // Create a persistent IRQ handler for the APU. It is owned by this Bus's CPU,
+    // so every console gets its own handler.
     IRQ &handler = cpu.createIRQHandler();
-    g_apu_irq = &handler;
+    apu_irq = &handler;
 
     // Construct the APU, providing:
-    //  - reference to the audio player so it can push samples into audio_player->audio_queue
     //  - reference to the IRQ handler (FrameCounter / DMC may need it)
     //  - a DMC memory-read callback that forwards to the Bus::read method
-    apu = new APU(*audio_player, handler, [this](uint16_t addr) -> uint8_t {
+    // No audio output is attached here; see APU::set_audio_queue().
+    apu = new APU(handler, [this](uint16_t addr) -> uint8_t {
         return this->read(addr);
-    });
-
-    // The APU implementation already accepts the IRQ and DMC callback above,
-    // so no additional setMemoryReadCallback / setIRQCallback wiring is required here.
+    }, 44100, options.audio);
+    map_pages();
+    ppu.update_memory_map();
+    schedule_apu_events();
+    schedule_ppu_events();
 }
 
 Bus::~Bus() {
     // Release the IRQ handler we created for the APU so the CPU's pulldown state
     // is cleaned up before destruction.
-    if (g_apu_irq) {
-        g_apu_irq->release();
-        g_apu_irq = nullptr;
+    if (apu_irq) {
+        apu_irq->release();
+        apu_irq = nullptr;
     }
 
     delete apu;
-    delete audio_player;
     delete cart;
 }
 
-uint8_t Bus::read(uint16_t addr) {
+void Bus::map_pages() {
+    // Internal RAM, mirrored four times.
+    for (int page = 0x00; page < 0x20; ++page) {
+        read_pages[page] = write_pages[page] = ram + ((page & 0x07) << 8);
+    }
+
+    // Only map cartridge pages that the mapper places linearly in PRG RAM or
+    // PRG ROM. ROM pages stay unmapped for writes, which go to the mapper.
+    pages_version = cart->mapper->get_prg_version();
+    for (int page = 0x40; page < 0x100 && options.page_tables; ++page) {
+        uint16_t addr = static_cast<uint16_t>(page << 8);
+        read_pages[page] = write_pages[page] = cart->mapper->prg_ram(addr);
+        if (write_pages[page])
+            continue;
+
+        uint32_t first = UINT32_MAX, last = UINT32_MAX;
+        uint8_t data = 0;
+        if (!cart->mapper->prgRead(addr, first, data) || !cart->mapper->prgRead(addr | 0xff, last, data))
+            continue;
+        if (last != first + 0xff || last >= cart->prg_size)
+            continue;
+        read_pages[page] = cart->prg + first;
+    }
+}
+
+uint8_t Bus::read_io(uint16_t addr) {
     uint8_t data = 0x00;
 
     if (cart && cart->cpuRead(addr, data))
@@ -63,8 +81,10 @@ uint8_t Bus::read(uint16_t addr) {
     if (addr <= 0x1FFF)
         return ram[addr & 0x07FF];
 
-    if (addr >= 0x2000 && addr <= 0x3FFF)
+    if (addr >= 0x2000 && addr <= 0x3FFF) {
+        sync_ppu(cycles + 1);
         return ppu.cpuRead(addr & 0x0007);
+    }
 
     if (addr == 0x4016 || addr == 0x4017) {
         int controller = addr & 0x0001;
@@ -84,6 +104,7 @@ uint8_t Bus::read(uint16_t addr) {
     if (addr >= 0x4000 && addr <= 0x4017) {
         // Only $4015 (status) is readable from the APU; other APU registers are write-only here.
         if (addr == 0x4015 && apu) {
+            sync_apu(cycles / 3 + 1);
             uint8_t status = apu->readStatus();
             if (getAPULogging()) {
                 std::fprintf(stderr, "[APU READ ] addr=$%04X -> $%02X\n", addr, status);
@@ -95,8 +116,17 @@ uint8_t Bus::read(uint16_t addr) {
     return data;
 }
 
-void Bus::write(uint16_t addr, uint8_t value) {
-    if (cart && cart->cpuWrite(addr, value))
+void Bus::write_io(uint16_t addr, uint8_t value) {
+    // Writes to $8000-$FFFF go to mapper registers, which may switch CHR banks
+    // or mirroring under the PPU.
+    if (addr >= 0x8000)
+        sync_ppu(cycles + 1);
+
+    bool handled = cart && cart->cpuWrite(addr, value);
+    if (cart && pages_version != cart->mapper->get_prg_version())
+        map_pages();
+    ppu.update_memory_map();
+    if (handled)
         return;
 
     if (addr <= 0x1FFF) {
@@ -105,7 +135,10 @@ void Bus::write(uint16_t addr, uint8_t value) {
     }
 
     if (addr >= 0x2000 && addr <= 0x3FFF) {
+        sync_ppu(cycles + 1);
         ppu.cpuWrite(addr & 0x0007, value);
+        // Turning rendering on or off moves the end of an odd frame.
+        schedule_ppu_events();
         return;
     }
 
@@ -131,7 +164,9 @@ void Bus::write(uint16_t addr, uint8_t value) {
     // APU and IO registers (0x4000..0x4017)
     if (addr >= 0x4000 && addr <= 0x4017) {
         if (apu) {
+            sync_apu(cycles / 3 + 1);
             apu->writeRegister(addr, value);
+            schedule_apu_events();
             if (getAPULogging()) {
                 std::fprintf(stderr, "[APU WRITE] addr=$%04X <= $%02X\n", addr, value);
             }
@@ -141,10 +176,10 @@ void Bus::write(uint16_t addr, uint8_t value) {
 }
 
 void Bus::clock() {
-    ppu.clock();
+    sync_ppu(cycles + 1);
 
     if ((cycles % 3) == 0) {
-        apu->step();
+        sync_apu(cycles / 3 + 1);
         if (dma_transfer) {
             if (dma_dummy) {
                 if ((cycles & 1) == 1) {
@@ -168,12 +203,192 @@ void Bus::clock() {
         }
     }
 
+    transfer_nmi();
+    cycles++;
+}
+
+void Bus::step_instruction() {
+    // Dot by dot up to the CPU's next instruction. Normally there is nothing
+    // to do here; it covers OAM DMA, the first call, and resuming after an
+    // instruction that was cut short at the end of a frame.
+    while ((cycles % 3) != 0 || dma_transfer || !cpu.ready()) {
+        clock();
+        if (ppu.frame_complete)
+            return;
+    }
+
+    // The CPU samples NMI and IRQ as it starts the instruction, so anything
+    // that could have raised one since the last sync is caught up first
+    // (everything before this dot; the APU steps before the CPU within a dot).
+    // Register accesses during the instruction sync the PPU and APU themselves.
+    if (scheduler.due(cycles)) {
+        sync_ppu(cycles);
+        sync_apu(cycles / 3 + 1);
+        transfer_nmi();
+        idle_loop.length = 0;
+    } else if (apu->has_audio()) {
+        sync_apu(cycles / 3 + 1);
+    }
+
+    // Stop tracking an idle loop once the CPU leaves it.
+    uint16_t pc = cpu.getPC();
+    if (idle_loop.length && static_cast<uint16_t>(pc - idle_loop.head) >= idle_loop.length)
+        idle_loop.length = 0;
+
+    // The rest of a compiled block, or a superinstruction's second half, may
+    // run without coming back here as long as nothing is scheduled up to that
+    // point.
+    int budget = 0;
+    if ((options.superinstructions || options.jit || options.aot) && !ppu.frame_complete && scheduler.next() > cycles) {
+        budget = static_cast<int>(std::min<uint64_t>((scheduler.next() - cycles - 1) / 3, 0xff));
+    }
+    int length = cpu.step(budget);
+
+    // An OAM DMA write stalls the CPU from its next cycle on, which is left to
+    // clock(). Otherwise skip to the end of the instruction, or to the end of
+    // the frame if that comes first. Unrecognized opcodes take no cycles but
+    // still use up this dot.
+    uint64_t end = cycles + 1;
+    if (!dma_transfer && length > 0)
+        end = cycles + 3 * length;
+    // If the instruction accessed the PPU on the dot the frame ended, that
+    // sync has already completed the frame (and scheduled the next one).
+    uint64_t frame_end = ppu.frame_complete ? ppu_dots : scheduler.when(Scheduler::PPU_FRAME_END);
+    if (frame_end <= end) {
+        end = frame_end;
+        sync_ppu(end);
+    }
+    cpu.idle_cycles(static_cast<int>((end - cycles - 1) / 3));
+    cycles = end;
+
+    // An NMI raised during the instruction (a $2000 write, or vblank while the
+    // PPU was synced) is taken when the next one starts.
+    transfer_nmi();
+
+    // A compiled block can run a whole loop iteration and end back where it
+    // started.
+    if (options.idle_skip && cpu.getPC() <= pc)
+        skip_idle_loop(pc);
+}
+
+// Called after a backward jump from `from`, or a compiled block that ended
+// where it began. If it closed an iteration of an idle loop (see
+// CPU::idle_loop_at()) and the CPU is back at the loop's head exactly as it
+// was one iteration ago, with no event in between, every further iteration
+// will be the same until something the loop reads changes. Internal RAM only
+// changes when the CPU writes it, which takes an interrupt and so an event,
+// and PPUSTATUS changes on the PPU's own schedule. So whole iterations are
+// skipped up to whichever comes first; only the clock moves, and the PPU and
+// APU catch up on it as usual.
+void Bus::skip_idle_loop(uint16_t from)
+{
+    uint16_t head = cpu.getPC();
+    bool reads_status = false;
+    int length = cpu.idle_loop_at(head, reads_status);
+    if (!length || static_cast<uint16_t>(from - head) >= length ||
+        !cpu.ready() || cpu.pendingNMI || ppu.frame_complete) {
+        idle_loop.length = 0;
+        return;
+    }
+
+    CPURegisters regs = cpu.get_regs();
+    uint8_t flags = cpu.get_flags().all;
+    if (idle_loop.length && idle_loop.head == head && idle_loop.flags == flags &&
+        idle_loop.regs.a == regs.a && idle_loop.regs.x == regs.x &&
+        idle_loop.regs.y == regs.y && idle_loop.regs.sp == regs.sp) {
+        uint64_t period = cycles - idle_loop.cycles;
+        uint64_t limit = scheduler.next();
+        // A status read on dot d sees the PPU's clocks up to and including d.
+        if (reads_status)
+            limit = std::min<uint64_t>(limit, ppu_dots + ppu.clocks_until_status_change() - 1);
+        if (limit > cycles) {
+            uint64_t skipped = (limit - cycles) / period * period;
+            cycles += skipped;
+            idle_dots += skipped;
+            cpu.wait_cycles(static_cast<int>(skipped / 3));
+            // Ending on the last dot of a frame completes it, as an
+            // instruction ending there would have.
+            if (cycles == scheduler.when(Scheduler::PPU_FRAME_END))
+                sync_ppu(cycles);
+        }
+    }
+
+    idle_loop.head = head;
+    idle_loop.length = static_cast<uint8_t>(length);
+    idle_loop.cycles = cycles;
+    idle_loop.regs = regs;
+    idle_loop.flags = flags;
+}
+
+void Bus::reset() {
+    cpu.reset();
+    ppu.reset();
+    schedule_ppu_events();
+    idle_loop.length = 0;
+}
+
+void Bus::run_frame(bool render_video) {
+    ppu.render_video = render_video;
+    while (!ppu.frame_complete) {
+        step_instruction();
+    }
+    ppu.frame_complete = false;
+    sync_apu((cycles + 2) / 3);
+}
+
+void Bus::run_cycles(uint64_t cpu_cycles) {
+    for (uint64_t i = 0; i < cpu_cycles * 3; ++i) {
+        clock();
+    }
+}
+
+void Bus::sync_apu(uint64_t steps) {
+    if (steps <= apu_steps)
+        return;
+
+    apu->run(static_cast<int>(steps - apu_steps));
+    apu_steps = steps;
+    // Past an event the APU's timers have been reloaded; look up the next ones.
+    uint64_t last = 3 * (steps - 1);
+    if (scheduler.when(Scheduler::APU_FRAME_COUNTER) <= last || scheduler.when(Scheduler::APU_DMC) <= last)
+        schedule_apu_events();
+}
+
+void Bus::schedule_apu_events() {
+    // The nth upcoming step is step apu_steps + n, at dot 3 * (apu_steps + n - 1).
+    scheduler.schedule(Scheduler::APU_FRAME_COUNTER, 3 * (apu_steps + apu->steps_until_frame_counter() - 1));
+
+    int dmc_steps = apu->steps_until_dmc();
+    if (dmc_steps > 0) {
+        scheduler.schedule(Scheduler::APU_DMC, 3 * (apu_steps + dmc_steps - 1));
+    } else {
+        scheduler.cancel(Scheduler::APU_DMC);
+    }
+}
+
+void Bus::sync_ppu(uint64_t dots) {
+    if (dots <= ppu_dots)
+        return;
+
+    for (; ppu_dots < dots; ++ppu_dots) {
+        ppu.clock();
+    }
+    if (scheduler.when(Scheduler::PPU_VBLANK) <= ppu_dots || scheduler.when(Scheduler::PPU_FRAME_END) <= ppu_dots)
+        schedule_ppu_events();
+}
+
+void Bus::schedule_ppu_events() {
+    // The nth upcoming PPU clock happens on dot ppu_dots + n - 1; its effects
+    // are visible from the next dot on.
+    scheduler.schedule(Scheduler::PPU_VBLANK, ppu_dots + ppu.clocks_until(241, 1));
+    scheduler.schedule(Scheduler::PPU_FRAME_END, ppu_dots + ppu.clocks_until(260, 340));
+}
+
+void Bus::transfer_nmi() {
     if (ppu.nmi) {
         ppu.nmi = false;
         cpu.pendingNMI = true;
     }
-
-    cycles++;
 }
 
 void Bus::set_controller_button(int index, ControllerButton button, bool pressed) {
@@ -191,6 +406,50 @@ void Bus::set_controller_button(int index, ControllerButton button, bool pressed
     }
 }
 
+void Bus::set_controller_state(int index, uint8_t buttons) {
+    if (index < 0 || index > 1)
+        return;
+
+    controller_state[index] = buttons;
+    if (controller_strobe & 0x01) {
+        controller_shift[index] = controller_state[index];
+    }
+}
+
+std::unique_ptr<Bus> Bus::clone(bool copy_framebuffer) const
+{
+    std::unique_ptr<Bus> copy(new Bus(cart->rom, options));
+    copy->copy_state(*this, copy_framebuffer);
+    return copy;
+}
+
+void Bus::copy_state(const Bus &other, bool copy_framebuffer)
+{
+    cart->copy_state(*other.cart);
+    map_pages();
+    cpu.copy_state(other.cpu);
+    ppu.copy_state(other.ppu, copy_framebuffer);
+    apu->copy_state(*other.apu);
+
+    // Only the 2KB of internal RAM is ever addressed (mirrored through $1FFF).
+    std::memcpy(ram, other.ram, 0x0800);
+    cycles = other.cycles;
+    dma_page = other.dma_page;
+    dma_addr = other.dma_addr;
+    dma_data = other.dma_data;
+    dma_transfer = other.dma_transfer;
+    dma_dummy = other.dma_dummy;
+    std::memcpy(controller_state, other.controller_state, sizeof(controller_state));
+    std::memcpy(controller_shift, other.controller_shift, sizeof(controller_shift));
+    controller_strobe = other.controller_strobe;
+    apu_logging = other.apu_logging;
+    scheduler = other.scheduler;
+    apu_steps = other.apu_steps;
+    ppu_dots = other.ppu_dots;
+    idle_loop = other.idle_loop;
+    idle_dots = other.idle_dots;
+}
+
 SaveState Bus::save_state() const
 {
     SaveState state{};
@@ -210,6 +469,7 @@ SaveState Bus::save_state() const
     state.controller_shift[0] = controller_shift[0];
     state.controller_shift[1] = controller_shift[1];
     state.controller_strobe = controller_strobe;
+    state.ppu_dots = ppu_dots;
     // APU save/load not performed here. Persist APU state inside the APU implementation
     // or reintroduce APUState to SaveState if you want the bus to store it.
     return state;
@@ -234,4 +494,10 @@ void Bus::load_state(const SaveState &state)
     controller_strobe = state.controller_strobe;
     // APU state restore not performed here. If APU state restore is required,
     // call apu->load_state(...) when an APUState/serialization API is available.
+    // Until then the APU simply carries on from the restored point in time.
+    apu_steps = (cycles + 2) / 3;
+    schedule_apu_events();
+    ppu_dots = state.ppu_dots;
+    schedule_ppu_events();
+    idle_loop.length = 0;
 }
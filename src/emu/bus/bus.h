@@ -4,11 +4,14 @@
 #include "../cartridge/cartridge.h"
 #include "../APU/apu.h"
 #include "src/emu/CPU/CPU.h"
+#include "scheduler.h"
 
-// Forward declarations for APU and AudioPlayer so the Bus header doesn't need
-// to directly include audio/APU implementation details.
-class AudioPlayer;
+#include <memory>
+
+// Forward declaration for the APU so the Bus header doesn't need to directly
+// include APU implementation details.
 class APU;
+class AotModule;
 
 struct SaveState {
     CPURegisters cpu_regs;
@@ -25,11 +28,47 @@ struct SaveState {
     uint8_t controller_shift[2];
     uint8_t controller_strobe;
     uint8_t ram[0x10000];
+    uint64_t ppu_dots;
+};
+
+// Construction-time console options.
+struct BusOptions {
+    // Without audio the APU skips waveform generation, sampling and mixing but
+    // still emulates $4015, the frame-counter IRQ and DMC DMA/IRQ. The core
+    // never opens an audio device either way.
+    bool audio = true;
+    // Run PRG ROM code from the CPU's per-bank decode cache. Off, every
+    // opcode and operand is fetched through the bus; the results are the same.
+    bool decode_cache = true;
+    // Let run_frame() execute common instruction pairs from the decode cache
+    // as one handler when nothing can happen between them.
+    bool superinstructions = true;
+    // Run hot PRG ROM code as native x86-64 code (see JitX64) instead of
+    // interpreting it; the results are the same. Needs the decode cache, and
+    // throws on other hosts.
+    bool jit = false;
+    // PRG ROM code compiled ahead of time by nestastic_aot (see AotModule),
+    // shared by every console given it. Its blocks run before the JIT's; the
+    // results are the same. Needs the decode cache, and throws if the module
+    // was generated from another ROM.
+    std::shared_ptr<const AotModule> aot;
+    // Let run_frame() skip over iterations of idle loops (polling RAM or
+    // PPUSTATUS) up to the next event; the results are the same. Needs the
+    // decode cache, which finds the loops.
+    bool idle_skip = true;
+    // Access cartridge memory (PRG ROM and RAM, CHR) through the bus's and
+    // PPU's page tables, which are rebuilt only when the mapper switches
+    // banks. Off, every such access goes through the Mapper interface; the
+    // results are the same.
+    bool page_tables = true;
 };
 
 class Bus {
 public:
-    explicit Bus(const char *rom_path);
+    explicit Bus(const char *rom_path, const BusOptions &options = BusOptions());
+    // Builds a console around an already loaded ROM image. The image is shared
+    // read-only, so any number of consoles can be created from one load.
+    explicit Bus(std::shared_ptr<const RomImage> rom, const BusOptions &options = BusOptions());
     ~Bus();
 
     enum ControllerButton : uint8_t {
@@ -46,23 +85,64 @@ public:
     CPU cpu = CPU(*this);
     PPU ppu = PPU(this);
     Cartridge *cart = nullptr;
-    // APU instance managed by the Bus (constructed at runtime)
+    // APU instance managed by the Bus (constructed at runtime). The Bus never
+    // opens an audio device itself; front-ends attach one via apu->set_audio_queue().
     APU *apu = nullptr;
-    // Audio player used by the APU; forward-declared above
-    AudioPlayer *audio_player = nullptr;
 
     uint8_t ram[0x10000] = {0};
 
-    // Read/write/clock entrypoints
-    uint8_t read(uint16_t addr);
-    void write(uint16_t addr, uint8_t value);
+    // Read/write/clock entrypoints. Plain memory is accessed straight
+    // through the page tables below; everything else is left to read_io()
+    // and write_io().
+    uint8_t read(uint16_t addr) {
+        if (const uint8_t *page = read_pages[addr >> 8])
+            return page[addr & 0xff];
+        return read_io(addr);
+    }
+    void write(uint16_t addr, uint8_t value) {
+        if (uint8_t *page = write_pages[addr >> 8]) {
+            page[addr & 0xff] = value;
+            return;
+        }
+        write_io(addr, value);
+    }
     void clock();
 
+    // Headless entrypoints: run until the PPU completes a frame, or for a fixed
+    // number of CPU cycles (three bus clocks each). run_frame(false) emulates
+    // the frame exactly but does not draw it (see PPU::render_video).
+    void run_frame(bool render_video = true);
+    void run_cycles(uint64_t cpu_cycles);
+
+    // Runs the CPU for one instruction (or interrupt), stopping early on the dot
+    // a frame completes. run_frame() is built on this. The PPU and APU are not
+    // clocked along with it: they are caught up, with exactly the same result
+    // as the equivalent clock() calls, when the CPU accesses them, when one of
+    // their events (vblank, frame end, frame counter, DMC) comes due, on mapper
+    // register writes, and at the end of each frame.
+    void step_instruction();
+
+    // Resets the CPU and PPU (the reset button).
+    void reset();
+
+    // Returns an independent console in the same state (and with the same
+    // options) as this one. It shares the immutable ROM image; RAM, CHR RAM,
+    // mapper, CPU, PPU and APU state are copied. Skipping the framebuffer
+    // (output only, redrawn every frame) makes a clone taken at a frame
+    // boundary considerably cheaper.
+    std::unique_ptr<Bus> clone(bool copy_framebuffer = true) const;
+
+    // Overwrites this console's state with other's, without allocating. Both
+    // consoles must have been built from the same ROM image.
+    void copy_state(const Bus &other, bool copy_framebuffer = true);
+
     SaveState save_state() const;
     void load_state(const SaveState &state);
 
     // Controller input
     void set_controller_button(int index, ControllerButton button, bool pressed);
+    // Sets every button at once; `buttons` uses the ControllerButton bit layout.
+    void set_controller_state(int index, uint8_t buttons);
 
     // APU logging: when enabled the Bus will print APU register reads/writes.
     // This toggle is intentionally part of the Bus so the wiring code in the
@@ -71,11 +151,65 @@ public:
     void setAPULogging(bool enable) { apu_logging = enable; }
     bool getAPULogging() const { return apu_logging; }
 
+    const BusOptions &get_options() const { return options; }
+    // The page tables read() and write() go through (see read_pages), for
+    // compiled PRG ROM code. They stay put for the bus's lifetime.
+    const uint8_t *const *get_read_pages() const { return read_pages; }
+    uint8_t *const *get_write_pages() const { return write_pages; }
+    // Dots run_frame() has skipped in idle loops so far.
+    uint64_t get_idle_dots() const { return idle_dots; }
+
 private:
     // Internal flag that controls emitting APU register access logs.
     bool apu_logging = false;
 
+    BusOptions options;
+
 private:
+    // IRQ line handed to the APU (frame counter / DMC); owned by the CPU.
+    IRQ *apu_irq = nullptr;
+
+    // The APU runs behind the rest of the console: it is only caught up when
+    // one of its events comes due, the CPU accesses $4000-$4017, or a frame
+    // ends. apu_steps counts the APU steps run so far; step n belongs to dot
+    // 3 * (n - 1). With audio it is still caught up every instruction so that
+    // samples keep flowing at an even rate.
+    Scheduler scheduler;
+    uint64_t apu_steps = 0;
+    void sync_apu(uint64_t steps);
+    void schedule_apu_events();
+
+    // Likewise the PPU has been clocked for dots [0, ppu_dots).
+    uint64_t ppu_dots = 0;
+    void sync_ppu(uint64_t dots);
+    void schedule_ppu_events();
+    void transfer_nmi();
+
+    // The idle loop the CPU is in, as of its last arrival at the loop's head.
+    // length is 0 when not tracking one.
+    struct IdleLoop {
+        uint16_t head = 0;
+        uint8_t length = 0;
+        uint64_t cycles = 0;
+        CPURegisters regs{};
+        uint8_t flags = 0;
+    };
+    IdleLoop idle_loop;
+    uint64_t idle_dots = 0;
+    void skip_idle_loop(uint16_t from);
+
+    // The CPU address space in 256-byte pages: the host memory behind each
+    // page, or nullptr where accesses have side effects or need the mapper
+    // (PPU, APU and I/O registers, mapper registers, unmapped space). Internal
+    // RAM never moves; the cartridge's pages are remapped whenever its mapper
+    // reports a PRG banking change.
+    const uint8_t *read_pages[0x100] = {};
+    uint8_t *write_pages[0x100] = {};
+    uint32_t pages_version = UINT32_MAX;
+    void map_pages();
+    uint8_t read_io(uint16_t addr);
+    void write_io(uint16_t addr, uint8_t value);
+
     uint64_t cycles = 0;
     uint8_t dma_page = 0x00;
     uint8_t dma_addr = 0x00;
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+// When each event source next needs attention, in master clock dots
+// (Bus::cycles): the first dot on which the CPU could observe the event.
+// Components that have nothing due are not run at all; the bus catches them
+// up in one slice when an event comes due or the CPU touches their
+// registers. There are only a few sources, so this is a fixed table with the
+// earliest time cached rather than a heap.
+class Scheduler {
+public:
+    enum Event {
+        APU_FRAME_COUNTER,  // next frame-counter sequencer step (length counters, frame IRQ)
+        APU_DMC,            // next DMC output clock (sample DMA, DMC IRQ)
+        PPU_VBLANK,         // dot after the next vblank start (NMI)
+        PPU_FRAME_END,      // dot after the PPU next completes a frame
+        EVENT_COUNT,
+    };
+
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    void schedule(Event event, uint64_t when) {
+        times[event] = when;
+        next_time = NEVER;
+        for (uint64_t time : times) {
+            if (time < next_time)
+                next_time = time;
+        }
+    }
+    void cancel(Event event) { schedule(event, NEVER); }
+
+    uint64_t when(Event event) const { return times[event]; }
+    // Earliest pending event.
+    uint64_t next() const { return next_time; }
+    bool due(uint64_t now) const { return now >= next_time; }
+
+private:
+    uint64_t times[EVENT_COUNT] = { NEVER, NEVER, NEVER, NEVER };
+    uint64_t next_time = NEVER;
+};
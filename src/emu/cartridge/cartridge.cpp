@@ -1,71 +1,89 @@
 #include <cstring>
-#include <fstream>
 #include <limits>
+#include <stdexcept>
 
 #include "cartridge.h"
 #include "../mapper/000/000.h"
 #include "../mapper/001/001.h"
 #include "../mapper/002/002.h"
+#include "../mapper/003/003.h"
+#include "../mapper/007/007.h"
+#include "../mapper/011/011.h"
+#include "../mapper/066/066.h"
 
 Cartridge* load_cartridge(std::string path) {
-    std::ifstream file(path, std::ios::binary);
-
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open ROM file: " + (path.empty() ? "No path provided." : path));
-    }
-
-    Cartridge *cart = new Cartridge();
-
-    uint8_t header[16];
-    file.read((char*)header, 16);
-
-    if (memcmp(header, "NES\x1A", 4) != 0) {
-        throw std::runtime_error("Not a NES ROM");
-    }
-
-    int prg_size = header[4] * 16 * 1024;
-    int chr_size = header[5] * 8 * 1024;
-
-    bool nes20 = (header[7] & 0x0C) == 0x08;
-    if (!nes20 && (header[12] || header[13] || header[14] || header[15])) {
-        header[7] &= 0x0F;
-    }
-    cart->mirroring_type =
-        (header[6] & 0x01) ? Mirroring::VERTICAL : Mirroring::HORIZONTAL;
-
-    // We don't support trainers.
-    if (header[6] & 0x04)
-        file.seekg(512, std::ios::cur);
-
-    cart->prg.resize(prg_size);
-    file.read((char*)cart->prg.data(), prg_size);
+    return load_cartridge(RomImage::load(path));
+}
 
-    if (chr_size == 0) {
-        // CHR RAM (8KB)
-        cart->chr.resize(8 * 1024);
-    } else {
-        cart->chr.resize(chr_size);
-        file.read((char*)cart->chr.data(), chr_size);
-    }
+Cartridge* load_cartridge(std::shared_ptr<const RomImage> rom) {
+    Cartridge *cart = new Cartridge(rom);
 
-    cart->mapperID = ((header[7] & 0xF0) | (header[6] >> 4));
     switch (cart->mapperID) {
         case 0:
-            cart->mapper = new Mapper_000(cart, header[4], header[5]);
+            cart->mapper = new Mapper_000(cart, rom->prg_banks(), rom->chr_banks());
             break;
         case 1:
-            cart->mapper = new Mapper_001(cart, header[4], header[5]);
+            cart->mapper = new Mapper_001(cart, rom->prg_banks(), rom->chr_banks());
             break;
         case 2:
-            cart->mapper = new Mapper_002(cart, header[4], header[5]);
+            cart->mapper = new Mapper_002(cart, rom->prg_banks(), rom->chr_banks());
+            break;
+        case 3:
+            cart->mapper = new Mapper_003(cart, rom->prg_banks(), rom->chr_banks());
+            break;
+        case 7:
+            cart->mapper = new Mapper_007(cart, rom->prg_banks(), rom->chr_banks());
+            break;
+        case 11:
+            cart->mapper = new Mapper_011(cart, rom->prg_banks(), rom->chr_banks());
+            break;
+        case 66:
+            cart->mapper = new Mapper_066(cart, rom->prg_banks(), rom->chr_banks());
             break;
-        default:
-            throw std::runtime_error("Unsupported mapper: " + std::to_string(cart->mapperID));
+        default: {
+            std::string message = "Unsupported mapper: " + std::to_string(cart->mapperID);
+            delete cart;
+            throw std::runtime_error(message);
+        }
     }
 
     return cart;
 }
 
+Cartridge::Cartridge(std::shared_ptr<const RomImage> rom) : rom(std::move(rom)) {
+    prg = this->rom->prg();
+    prg_size = this->rom->prg_size();
+
+    if (this->rom->chr_size() == 0) {
+        // CHR RAM (8KB)
+        chr_ram.resize(8 * 1024);
+        chr = chr_ram.data();
+        chr_size = chr_ram.size();
+    } else {
+        chr = this->rom->chr();
+        chr_size = this->rom->chr_size();
+    }
+
+    mirroring_type = this->rom->mirroring();
+    mapperID = this->rom->mapper_id();
+}
+
+Cartridge::~Cartridge() {
+    delete mapper;
+}
+
+void Cartridge::copy_state(const Cartridge &other) {
+    if (rom != other.rom) {
+        throw std::runtime_error("Cannot copy cartridge state between different ROM images");
+    }
+
+    if (!chr_ram.empty()) {
+        std::memcpy(chr_ram.data(), other.chr_ram.data(), chr_ram.size());
+    }
+    mirroring_type = other.mirroring_type;
+    mapper->copy_state(*other.mapper);
+}
+
 bool Cartridge::cpuRead(uint16_t addr, uint8_t &data) {
     uint32_t mapped_addr = std::numeric_limits<uint32_t>::max();
 
@@ -75,7 +93,7 @@ bool Cartridge::cpuRead(uint16_t addr, uint8_t &data) {
     if (mapper && mapper->prgRead(addr, mapped_addr, data)) {
         if (mapped_addr != std::numeric_limits<uint32_t>::max()) {
             // Mapper returned a PRG ROM/RAM index to read from.
-            if (mapped_addr < prg.size()) {
+            if (mapped_addr < prg_size) {
                 data = prg[mapped_addr];
                 return true;
             } else {
@@ -93,12 +111,10 @@ bool Cartridge::cpuRead(uint16_t addr, uint8_t &data) {
 bool Cartridge::cpuWrite(uint16_t addr, uint8_t data) {
     uint32_t mapped_addr = std::numeric_limits<uint32_t>::max();
 
+    // PRG ROM is shared between consoles and never written; a mapper that
+    // claims the write has either handled it (PRG RAM, registers) or it is
+    // simply dropped.
     if (mapper && mapper->prgWrite(addr, mapped_addr, data)) {
-        if (mapped_addr != std::numeric_limits<uint32_t>::max()) {
-            if (mapped_addr < prg.size()) {
-                prg[mapped_addr] = data;
-            }
-        }
         return true;
     }
 
@@ -109,7 +125,7 @@ bool Cartridge::ppuRead(uint16_t addr, uint8_t &data) {
     uint32_t mapped_addr = 0;
 
     if (mapper && mapper->chrRead(addr, mapped_addr)) {
-        if (mapped_addr < chr.size()) {
+        if (mapped_addr < chr_size) {
             data = chr[mapped_addr];
             return true;
         }
@@ -124,8 +140,8 @@ bool Cartridge::ppuWrite(uint16_t addr, uint8_t data) {
 
     if (mapper && mapper->chrWrite(addr, mapped_addr, data)) {
         if (mapped_addr != std::numeric_limits<uint32_t>::max()) {
-            if (mapped_addr < chr.size()) {
-                chr[mapped_addr] = data;
+            if (mapped_addr < chr_ram.size()) {
+                chr_ram[mapped_addr] = data;
             }
         }
         return true;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "src/emu/mapper/mapper.h"
+#include "rom_image.h"
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -9,24 +11,35 @@ typedef class Mapper Mapper;
 typedef class Cartridge Cartridge;
 
 Cartridge* load_cartridge(std::string path);
-
-enum class Mirroring {
-    HORIZONTAL,
-    VERTICAL,
-    FOUR_SCREEN,
-    SINGLE_SCREEN
-};
+Cartridge* load_cartridge(std::shared_ptr<const RomImage> rom);
 
 class Cartridge {
 public:
-    std::vector<uint8_t> prg;   // PRG ROM (16k or 32k)
-    std::vector<uint8_t> chr;   // CHR ROM/RAM
+    explicit Cartridge(std::shared_ptr<const RomImage> rom);
+    ~Cartridge();
+
+    Cartridge(const Cartridge&) = delete;
+    Cartridge& operator=(const Cartridge&) = delete;
+
+    // Shared, read-only ROM image backing prg/chr.
+    std::shared_ptr<const RomImage> rom;
+
+    const uint8_t *prg = nullptr;   // PRG ROM (16k or 32k), points into rom
+    size_t prg_size = 0;
+
+    const uint8_t *chr = nullptr;   // CHR ROM (points into rom) or chr_ram
+    size_t chr_size = 0;
+    std::vector<uint8_t> chr_ram;   // Private 8KB CHR RAM, empty for CHR ROM carts
 
     Mirroring mirroring_type;
 
     uint8_t mapperID = 0;
     Mapper *mapper = nullptr;
 
+    // Copies CHR RAM, mirroring and mapper state from a cartridge built from
+    // the same ROM image.
+    void copy_state(const Cartridge &other);
+
     bool cpuRead(uint16_t addr, uint8_t &data);
     bool cpuWrite(uint16_t addr, uint8_t data);
     bool ppuRead(uint16_t addr, uint8_t &data);
@@ -0,0 +1,109 @@
+#include "rom_image.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<const RomImage> RomImage::load(const std::string &path, bool map_file) {
+    std::shared_ptr<RomImage> image(new RomImage());
+
+#ifndef _WIN32
+    if (map_file) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open ROM file: " + (path.empty() ? "No path provided." : path));
+        }
+
+        struct stat st;
+        void *mapping = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (mapping != MAP_FAILED) {
+            image->mapping = mapping;
+            image->mapping_size = st.st_size;
+            image->parse(static_cast<const uint8_t*>(mapping), st.st_size);
+            return image;
+        }
+        // Fall through and read the file normally if it can't be mapped.
+    }
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open ROM file: " + (path.empty() ? "No path provided." : path));
+    }
+
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    image->storage = std::move(contents);
+    image->parse(image->storage.data(), image->storage.size());
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::from_memory(const uint8_t *data, size_t size) {
+    std::shared_ptr<RomImage> image(new RomImage());
+    image->storage.assign(data, data + size);
+    image->parse(image->storage.data(), image->storage.size());
+    return image;
+}
+
+RomImage::~RomImage() {
+#ifndef _WIN32
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+#endif
+}
+
+void RomImage::parse(const uint8_t *file, size_t size) {
+    uint8_t header[16] = {0};
+    std::memcpy(header, file, size < sizeof(header) ? size : sizeof(header));
+
+    if (memcmp(header, "NES\x1A", 4) != 0) {
+        throw std::runtime_error("Not a NES ROM");
+    }
+
+    size_t prg_size = header[4] * 16 * 1024;
+    size_t chr_size = header[5] * 8 * 1024;
+
+    bool nes20 = (header[7] & 0x0C) == 0x08;
+    if (!nes20 && (header[12] || header[13] || header[14] || header[15])) {
+        header[7] &= 0x0F;
+    }
+    mirroring_type = (header[6] & 0x01) ? Mirroring::VERTICAL : Mirroring::HORIZONTAL;
+    mapper = ((header[7] & 0xF0) | (header[6] >> 4));
+    prg_bank_count = header[4];
+    chr_bank_count = header[5];
+
+    // We don't support trainers.
+    size_t offset = sizeof(header);
+    if (header[6] & 0x04)
+        offset += 512;
+
+    if (offset + prg_size + chr_size > size) {
+        // Truncated file: keep what is there and zero-fill the rest.
+        std::vector<uint8_t> padded(prg_size + chr_size, 0);
+        if (offset < size) {
+            std::memcpy(padded.data(), file + offset, std::min(size - offset, padded.size()));
+        }
+        storage = std::move(padded);
+        file = storage.data();
+        offset = 0;
+    }
+
+    prg_data = file + offset;
+    prg_bytes = prg_size;
+    chr_data = chr_size ? file + offset + prg_size : nullptr;
+    chr_bytes = chr_size;
+}
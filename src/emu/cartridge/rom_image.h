@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class Mirroring {
+    HORIZONTAL,
+    VERTICAL,
+    FOUR_SCREEN,
+    SINGLE_SCREEN
+};
+
+// A parsed iNES file. The PRG/CHR ROM bytes are immutable, so one image is
+// loaded once and shared by every Cartridge (and therefore every console)
+// running that game. Per-console mutable memory (CHR RAM, PRG RAM) lives in
+// the Cartridge / mapper instead.
+class RomImage {
+public:
+    // Reads the file into memory. With map_file the ROM data is mmap'd
+    // read-only instead, so all processes running the game share its pages.
+    static std::shared_ptr<const RomImage> load(const std::string &path, bool map_file = false);
+    static std::shared_ptr<const RomImage> from_memory(const uint8_t *data, size_t size);
+
+    ~RomImage();
+
+    RomImage(const RomImage&) = delete;
+    RomImage& operator=(const RomImage&) = delete;
+
+    const uint8_t *prg() const { return prg_data; }
+    size_t prg_size() const { return prg_bytes; }
+
+    // chr_size() == 0 means the cartridge uses 8KB of CHR RAM instead.
+    const uint8_t *chr() const { return chr_data; }
+    size_t chr_size() const { return chr_bytes; }
+
+    uint8_t mapper_id() const { return mapper; }
+    uint8_t prg_banks() const { return prg_bank_count; }
+    uint8_t chr_banks() const { return chr_bank_count; }
+    Mirroring mirroring() const { return mirroring_type; }
+
+private:
+    RomImage() = default;
+
+    // Parses the header and points prg/chr into `file` (size bytes). If the file
+    // is shorter than the header claims, the ROM is copied into zero-padded
+    // storage instead.
+    void parse(const uint8_t *file, size_t size);
+
+    std::vector<uint8_t> storage;
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+
+    const uint8_t *prg_data = nullptr;
+    size_t prg_bytes = 0;
+    const uint8_t *chr_data = nullptr;
+    size_t chr_bytes = 0;
+
+    uint8_t mapper = 0;
+    uint8_t prg_bank_count = 0;
+    uint8_t chr_bank_count = 0;
+    Mirroring mirroring_type = Mirroring::HORIZONTAL;
+};
@@ -57,6 +57,10 @@
 
 void Mapper_000::reset() {};
 
+void Mapper_000::copy_state(const Mapper &other) {
+	// NROM has no bank registers.
+}
+
 bool Mapper_000::prgRead(uint16_t addr, uint32_t &mapped_addr, uint8_t &data)
 {
 	// if PRGROM is 16KB
@@ -102,7 +106,7 @@ bool Mapper_000::chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 		if (nCHRBanks == 0)
 		{
 			mapped_addr = addr;
-			cart->chr[mapped_addr] = data;
+			cart->chr_ram[mapped_addr] = data;
 			return true;
 		}
 	}
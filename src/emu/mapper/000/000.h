@@ -74,5 +74,6 @@ public:
     virtual bool chrRead(uint16_t addr, uint32_t &mapped_addr) override;
     virtual bool chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) override;
 	void reset() override;
+	void copy_state(const Mapper &other) override;
 
 };
@@ -51,6 +51,7 @@ bool Mapper_001::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
 			load_register = 0x00;
 			load_register_cnt = 0;
 			ctrl_reg = ctrl_reg | 0x0C;
+			++prg_version;
 		} else {
 			load_register >>= 1;
 			load_register |= (data & 0x01) << 4;
@@ -64,6 +65,8 @@ bool Mapper_001::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
 				if (nTargetRegister == 0) {
 					// Set Control Register
 					ctrl_reg = load_register & 0x1F;
+					++prg_version;
+					++chr_version;
 
 					// Decide which nametable mirroring mode to use.
 					// For one-screen modes we record which bank (low=0, high=1)
@@ -99,6 +102,7 @@ bool Mapper_001::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
 						// 8K CHR Bank at PPU 0x0000
 						chr.bank8 = load_register & 0x1E;
 					}
+					++chr_version;
 				} else if (nTargetRegister == 2) {
 					// Set CHR Bank Hi
 					if (ctrl_reg & 0b10000)
@@ -106,6 +110,7 @@ bool Mapper_001::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
 						// 4K CHR Bank at PPU 0x1000
 						chr.bank4Hi = load_register & 0x1F;
 					}
+					++chr_version;
 				} else if (nTargetRegister == 3) {
 					// Configure PRG Banks
 					uint8_t nPRGMode = (ctrl_reg >> 2) & 0x03;
@@ -124,6 +129,7 @@ bool Mapper_001::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
 						// Fix 16KB PRG Bank at CPU 0xC000 to Last Bank
 						prg.bank16Hi = nPRGBanks - 1;
 					}
+					++prg_version;
 				}
 
 				// 5 bits were written, and decoded, so
@@ -172,7 +178,7 @@ bool Mapper_001::chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 		// If there are no CHR banks the cartridge uses CHR RAM (writable).
 		if (nCHRBanks == 0) {
 			mapped_addr = addr;
-			cart->chr[mapped_addr] = data;
+			cart->chr_ram[mapped_addr] = data;
 			return true;
 		}
 
@@ -187,6 +193,29 @@ int Mapper_001::get_onescreen_bank() {
 	return onescreen_bank;
 }
 
+uint8_t *Mapper_001::prg_ram(uint16_t addr) {
+	if (addr >= 0x6000 && addr <= 0x7FFF)
+		return &vram[addr & 0x1FFF];
+	return nullptr;
+}
+
+void Mapper_001::copy_state(const Mapper &other) {
+	const Mapper_001 &src = static_cast<const Mapper_001&>(other);
+	chr.bank4Lo = src.chr.bank4Lo;
+	chr.bank4Hi = src.chr.bank4Hi;
+	chr.bank8 = src.chr.bank8;
+	prg.bank16Lo = src.prg.bank16Lo;
+	prg.bank16Hi = src.prg.bank16Hi;
+	prg.bank32 = src.prg.bank32;
+	load_register = src.load_register;
+	load_register_cnt = src.load_register_cnt;
+	ctrl_reg = src.ctrl_reg;
+	onescreen_bank = src.onescreen_bank;
+	vram = src.vram;
+	++prg_version;
+	++chr_version;
+}
+
 void Mapper_001::reset() {
 	ctrl_reg = 0x1C;
 	load_register = 0x00;
@@ -207,4 +236,6 @@ void Mapper_001::reset() {
 	prg.bank32 = 0;
 	prg.bank16Lo = 0;
 	prg.bank16Hi = nPRGBanks - 1;
+	++prg_version;
+	++chr_version;
 }
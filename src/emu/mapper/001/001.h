@@ -21,7 +21,10 @@ public:
     // mirroring type is SINGLE_SCREEN. Return 0 for lower, 1 for higher, -1 if not applicable.
     virtual int get_onescreen_bank() override;
 
+    uint8_t *prg_ram(uint16_t addr) override;
+
     void reset() override;
+    void copy_state(const Mapper &other) override;
 
 private:
     Cartridge *cart;
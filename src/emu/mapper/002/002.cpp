@@ -1,8 +1,16 @@
 #include "002.h"
 
+void Mapper_002::copy_state(const Mapper &other) {
+	const Mapper_002 &src = static_cast<const Mapper_002&>(other);
+	select_prg_lo = src.select_prg_lo;
+	select_prg_hi = src.select_prg_hi;
+	++prg_version;
+}
+
 void Mapper_002::reset() {
 	select_prg_lo = 0;
 	select_prg_hi = nPRGBanks ? nPRGBanks - 1 : 0;
+	++prg_version;
 }
 
 bool Mapper_002::prgRead(uint16_t addr, uint32_t &mapped_addr, uint8_t &data) {
@@ -25,6 +33,7 @@ bool Mapper_002::prgRead(uint16_t addr, uint32_t &mapped_addr, uint8_t &data) {
 bool Mapper_002::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
 	if (addr >= 0x8000 && addr <= 0xFFFF && nPRGBanks != 0) {
 		select_prg_lo = data % nPRGBanks;
+		++prg_version;
 	}
     return false;
 }
@@ -41,7 +50,7 @@ bool Mapper_002::chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
     if (addr < 0x2000) {
 		if (nCHRBanks == 0) {
 			mapped_addr = addr;
-			cart->chr[mapped_addr] = data;
+			cart->chr_ram[mapped_addr] = data;
 			return true;
 		}
 	}
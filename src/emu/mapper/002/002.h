@@ -17,6 +17,7 @@ public:
     virtual bool chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) override;
 
     void reset() override;
+    void copy_state(const Mapper &other) override;
 
 private:
     Cartridge *cart;
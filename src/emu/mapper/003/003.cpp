@@ -0,0 +1,10 @@
+#include "003.h"
+
+void Mapper_003::write_register(uint16_t, uint8_t data) {
+	registers[0] = data;
+}
+
+void Mapper_003::update_banks() {
+	map_prg_32k(0);
+	map_chr_8k(registers[0]);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+
+#include "../banked_mapper.h"
+
+// CNROM: fixed PRG, 8KB CHR banks selected by any write to $8000-$FFFF.
+class Mapper_003 : public BankedMapper {
+public:
+    Mapper_003(Cartridge *cart, uint8_t prg_banks, uint8_t chr_banks) : BankedMapper(cart, prg_banks, chr_banks) {
+        reset();
+    };
+    ~Mapper_003() = default;
+
+protected:
+    void write_register(uint16_t addr, uint8_t data) override;
+    void update_banks() override;
+};
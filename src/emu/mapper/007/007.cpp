@@ -0,0 +1,11 @@
+#include "007.h"
+
+void Mapper_007::write_register(uint16_t, uint8_t data) {
+	registers[0] = data;
+}
+
+void Mapper_007::update_banks() {
+	map_prg_32k(registers[0] & 0x07);
+	map_chr_8k(0);
+	set_mirroring(Mirroring::SINGLE_SCREEN, (registers[0] >> 4) & 0x01);
+}
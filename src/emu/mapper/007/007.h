@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+#include "../banked_mapper.h"
+
+// AxROM: 32KB PRG banks and a one-screen nametable, selected by writes to
+// $8000-$FFFF (PRG in bits 0-2, nametable in bit 4). CHR is RAM.
+class Mapper_007 : public BankedMapper {
+public:
+    Mapper_007(Cartridge *cart, uint8_t prg_banks, uint8_t chr_banks) : BankedMapper(cart, prg_banks, chr_banks) {
+        reset();
+    };
+    ~Mapper_007() = default;
+
+protected:
+    void write_register(uint16_t addr, uint8_t data) override;
+    void update_banks() override;
+};
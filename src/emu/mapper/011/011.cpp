@@ -0,0 +1,10 @@
+#include "011.h"
+
+void Mapper_011::write_register(uint16_t, uint8_t data) {
+	registers[0] = data;
+}
+
+void Mapper_011::update_banks() {
+	map_prg_32k(registers[0] & 0x03);
+	map_chr_8k(registers[0] >> 4);
+}
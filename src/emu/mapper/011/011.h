@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+#include "../banked_mapper.h"
+
+// Color Dreams: 32KB PRG banks in bits 0-1 and 8KB CHR banks in bits 4-7 of
+// writes to $8000-$FFFF.
+class Mapper_011 : public BankedMapper {
+public:
+    Mapper_011(Cartridge *cart, uint8_t prg_banks, uint8_t chr_banks) : BankedMapper(cart, prg_banks, chr_banks) {
+        reset();
+    };
+    ~Mapper_011() = default;
+
+protected:
+    void write_register(uint16_t addr, uint8_t data) override;
+    void update_banks() override;
+};
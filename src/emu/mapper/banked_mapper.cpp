@@ -0,0 +1,117 @@
+#include "banked_mapper.h"
+
+#include <cstring>
+
+BankedMapper::BankedMapper(Cartridge *cart, uint8_t prgBanks, uint8_t chrBanks) : Mapper(prgBanks, chrBanks), cart(cart) {
+	// Until a mapper maps anything: the first 32KB of PRG and 8KB of CHR.
+	map_prg_32k(0);
+	map_chr_8k(0);
+}
+
+bool BankedMapper::prgRead(uint16_t addr, uint32_t &mapped_addr, uint8_t &data) {
+	if (addr < 0x8000)
+		return false;
+	mapped_addr = prg_slots[(addr >> 13) & 0x03] + (addr & 0x1FFF);
+	return true;
+}
+
+bool BankedMapper::prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
+	if (addr >= 0x8000) {
+		write_register(addr, data);
+		remap();
+	}
+	// Registers only; PRG ROM itself is never written.
+	return false;
+}
+
+bool BankedMapper::chrRead(uint16_t addr, uint32_t &mapped_addr) {
+	if (addr >= 0x2000)
+		return false;
+	mapped_addr = chr_slots[addr >> 10] + (addr & 0x03FF);
+	return true;
+}
+
+bool BankedMapper::chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) {
+	if (addr >= 0x2000 || nCHRBanks != 0)
+		return false;
+	mapped_addr = chr_slots[addr >> 10] + (addr & 0x03FF);
+	return true;
+}
+
+void BankedMapper::reset() {
+	std::memset(registers, 0, sizeof(registers));
+	remap();
+}
+
+void BankedMapper::copy_state(const Mapper &other) {
+	const BankedMapper &src = static_cast<const BankedMapper&>(other);
+	std::memcpy(registers, src.registers, sizeof(registers));
+	remap();
+}
+
+// Runs update_banks() and tells the CPU, bus and PPU about whatever moved.
+void BankedMapper::remap() {
+	uint32_t old_prg[4], old_chr[8];
+	std::memcpy(old_prg, prg_slots, sizeof(prg_slots));
+	std::memcpy(old_chr, chr_slots, sizeof(chr_slots));
+	Mirroring old_mirroring = cart->mirroring_type;
+	int old_onescreen_bank = onescreen_bank;
+
+	update_banks();
+
+	if (std::memcmp(old_prg, prg_slots, sizeof(prg_slots)) != 0)
+		++prg_version;
+	if (std::memcmp(old_chr, chr_slots, sizeof(chr_slots)) != 0 ||
+		old_mirroring != cart->mirroring_type || old_onescreen_bank != onescreen_bank)
+		++chr_version;
+}
+
+// A cartridge without PRG ROM (or CHR) has no banks to pick from; the slots
+// stay at offset 0, which the bus and PPU bounds-check like any other.
+void BankedMapper::map_prg_8k(int slot, int bank) {
+	uint32_t banks = cart->prg_size / 0x2000;
+	if (banks == 0)
+		return;
+	prg_slots[slot & 0x03] = (bank % banks) * 0x2000;
+}
+
+void BankedMapper::map_prg_16k(int slot, int bank) {
+	uint32_t banks = cart->prg_size / 0x4000;
+	if (banks == 0)
+		return;
+	uint32_t offset = (bank % banks) * 0x4000;
+	prg_slots[(slot * 2) & 0x03] = offset;
+	prg_slots[(slot * 2 + 1) & 0x03] = offset + 0x2000;
+}
+
+void BankedMapper::map_prg_32k(int bank) {
+	// A 16KB ROM is mirrored into both halves.
+	uint32_t size = cart->prg_size < 0x8000 ? cart->prg_size : 0x8000;
+	if (size == 0)
+		return;
+	uint32_t offset = (bank % (cart->prg_size / size)) * size;
+	for (int slot = 0; slot < 4; ++slot)
+		prg_slots[slot] = offset + (slot * 0x2000) % size;
+}
+
+void BankedMapper::map_chr_1k(int slot, int bank) {
+	uint32_t banks = cart->chr_size / 0x0400;
+	if (banks == 0)
+		return;
+	chr_slots[slot & 0x07] = (bank % banks) * 0x0400;
+}
+
+void BankedMapper::map_chr_4k(int slot, int bank) {
+	for (int i = 0; i < 4; ++i)
+		map_chr_1k(slot * 4 + i, bank * 4 + i);
+}
+
+void BankedMapper::map_chr_8k(int bank) {
+	for (int i = 0; i < 8; ++i)
+		map_chr_1k(i, bank * 8 + i);
+}
+
+void BankedMapper::set_mirroring(Mirroring mirroring, int bank) {
+	cart->mirroring_type = mirroring;
+	onescreen_bank = mirroring == Mirroring::SINGLE_SCREEN ? bank : -1;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+
+#include "mapper.h"
+#include "../cartridge/cartridge.h"
+
+// Base for mappers that only switch whole banks. PRG ROM at $8000-$FFFF is
+// four 8KB slots and CHR at PPU $0000-$1FFF eight 1KB slots, each holding
+// the offset of the bank mapped there. A mapper only stores its register
+// writes (write_register()) and says where the banks go (update_banks()),
+// which runs whenever the registers change. Reads are a slot lookup, and the
+// bus and PPU cache the slots in their own page tables anyway.
+//
+// All state lives in registers, so reset() and copy_state() need nothing
+// from the mapper itself.
+class BankedMapper : public Mapper {
+public:
+	BankedMapper(Cartridge *cart, uint8_t prgBanks, uint8_t chrBanks);
+
+	bool prgRead(uint16_t addr, uint32_t &mapped_addr, uint8_t &data) override;
+	bool prgWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) override;
+	bool chrRead(uint16_t addr, uint32_t &mapped_addr) override;
+	bool chrWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data) override;
+
+	void reset() override;
+	void copy_state(const Mapper &other) override;
+	int get_onescreen_bank() override { return onescreen_bank; }
+
+protected:
+	// A CPU write to $8000-$FFFF. update_banks() follows.
+	virtual void write_register(uint16_t addr, uint8_t data) = 0;
+	// Maps every slot (and sets mirroring, if the mapper controls it) from
+	// the registers.
+	virtual void update_banks() = 0;
+
+	// Bank numbers are in units of the bank size and wrap around the ROM.
+	void map_prg_8k(int slot, int bank);
+	void map_prg_16k(int slot, int bank);
+	void map_prg_32k(int bank);
+	void map_chr_1k(int slot, int bank);
+	void map_chr_4k(int slot, int bank);
+	void map_chr_8k(int bank);
+	// bank is the nametable used with Mirroring::SINGLE_SCREEN.
+	void set_mirroring(Mirroring mirroring, int bank = -1);
+
+	Cartridge *cart;
+	uint8_t registers[8] = {};
+
+private:
+	void remap();
+
+	uint32_t prg_slots[4] = {};
+	uint32_t chr_slots[8] = {};
+	int onescreen_bank = -1;
+};
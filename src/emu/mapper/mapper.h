@@ -5,7 +5,7 @@
 class Mapper {
 public:
 	Mapper(uint8_t prgBanks, uint8_t chrBanks);
-	~Mapper();
+	virtual ~Mapper();
 
 public:
 
@@ -17,9 +17,28 @@ public:
 
 	virtual void reset() = 0;
 
+	// Copies bank registers and mapper RAM from a mapper of the same type.
+	virtual void copy_state(const Mapper &other) = 0;
+
 	virtual int get_onescreen_bank() { return -1; };
 
+	// The PRG RAM byte at addr, if the mapper has plain (side effect free)
+	// RAM there, otherwise nullptr. Must stay valid until the PRG version
+	// next changes.
+	virtual uint8_t *prg_ram(uint16_t addr) { return nullptr; }
+
+	// Changes whenever the PRG ROM banks mapped at $8000-$FFFF (or the PRG
+	// RAM returned by prg_ram()) may have changed, so the CPU knows to remap
+	// its decoded code windows and the bus its page tables.
+	uint32_t get_prg_version() const { return prg_version; }
+	// Likewise for the CHR banks mapped at PPU $0000-$1FFF and the
+	// nametable mirroring, for the PPU's memory map.
+	uint32_t get_chr_version() const { return chr_version; }
+
 protected:
+	uint32_t prg_version = 0;
+	uint32_t chr_version = 0;
+
 	// These are stored locally as many of the mappers require this information
 	uint8_t nPRGBanks = 0;
 	uint8_t nCHRBanks = 0;
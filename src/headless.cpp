@@ -0,0 +1,804 @@
+#include "emu/bus/bus.h"
+#include "emu/CPU/aot_module.h"
+#include "emu/batch/batch_runner.h"
+#include "emu/batch/vec_env.h"
+#ifndef _WIN32
+#include "emu/batch/fork_server.h"
+
+#include <csignal>
+#include <sys/wait.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// NTSC NES frame rate, used to report emulation speed relative to real time.
+static constexpr double NES_FRAME_RATE = 60.0988;
+
+static void print_usage(const char *argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s --rom <path> [--mmap] [--audio] [--no-decode-cache] [--no-idle-skip] [--no-page-tables] [--jit] [--aot <module>] [--frames N] [--render-every N] [--dump-framebuffer <file.ppm>]\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --batch N [--threads N]\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-threads N\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-vec-env N\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-clone\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-render-skip\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-stepping\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-decode-cache\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-jit\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --aot <module> --check-aot\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-idle-skip\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-page-tables\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --fork N [--scripts N]\n"
+        "       %s --rom <path> [--mmap] [--audio] [--frames N] --check-fork-crash\n"
+        "\n"
+        "  --rom <path>                 iNES ROM to load\n"
+        "  --mmap                       map the ROM file instead of reading it\n"
+        "  --audio                      also generate audio samples (nothing is played)\n"
+        "  --frames N                   number of frames to emulate (default 600)\n"
+        "  --render-every N             only draw every Nth frame (and the last one)\n"
+        "  --dump-framebuffer <file>    write the last frame as a binary PPM\n"
+        "  --batch N                    step N consoles with the batch runner\n"
+        "  --threads N                  batch worker threads (default: all cores)\n"
+        "  --check-threads N            run N consoles on N threads and verify their\n"
+        "                               framebuffer, RAM and CPU state are bit-identical\n"
+        "  --check-vec-env N            step N consoles through VecEnv and verify every\n"
+        "                               observation against plain consoles given the same input\n"
+        "  --check-clone                clone a console halfway through the run and verify\n"
+        "                               both copies finish identical to an unbroken run\n"
+        "  --check-render-skip          verify that skipping video output leaves the\n"
+        "                               emulated state identical to a fully drawn run\n"
+        "  --check-stepping             verify that run_frame (instruction stepping with lazy\n"
+        "                               PPU/APU catch-up) matches clocking every dot, every frame\n"
+        "  --check-decode-cache         verify that running from the CPU decode cache matches\n"
+        "                               fetching every instruction through the bus, every frame\n"
+        "  --check-jit                  verify that running hot PRG ROM code as compiled x86-64\n"
+        "                               code matches interpreting it, every frame\n"
+        "  --check-aot                  verify that running the --aot module's code matches\n"
+        "                               interpreting it, every frame\n"
+        "  --check-idle-skip            verify that skipping idle loop iterations matches running\n"
+        "                               them, every frame\n"
+        "  --check-page-tables          verify that accessing cartridge memory through the page\n"
+        "                               tables matches going through the mapper, every frame\n"
+        "  --no-decode-cache            fetch every instruction through the bus\n"
+        "  --no-idle-skip               run every iteration of idle loops\n"
+        "  --no-page-tables             access cartridge memory through the mapper\n"
+        "  --jit                        compile hot PRG ROM code to x86-64 code\n"
+        "  --aot <module>               run PRG ROM code from a module built from\n"
+        "                               nestastic_aot's output for this ROM\n"
+        "  --fork N                     run --frames frames, then fork N worker processes\n"
+        "                               and replay random input scripts in them\n"
+        "  --scripts N                  scripts to run with --fork (default 64)\n"
+        "  --check-fork-crash           kill a fork worker and verify submitting to it\n"
+        "                               raises an error instead of a SIGPIPE\n",
+        argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+static bool dump_framebuffer(const Bus &bus, const char *path)
+{
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::fprintf(file, "P6\n256 240\n255\n");
+    for (int i = 0; i < 256 * 240; ++i) {
+        uint32_t color = bus.ppu.framebuffer[i];
+        uint8_t rgb[3] = {
+            static_cast<uint8_t>(color >> 16),
+            static_cast<uint8_t>(color >> 8),
+            static_cast<uint8_t>(color),
+        };
+        std::fwrite(rgb, 1, sizeof(rgb), file);
+    }
+
+    return std::fclose(file) == 0;
+}
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Hash of everything a caller can observe about a console after a run.
+static uint64_t console_hash(const Bus &bus)
+{
+    CPURegisters regs = bus.cpu.get_regs();
+    uint8_t reg_bytes[] = {
+        static_cast<uint8_t>(regs.pc), static_cast<uint8_t>(regs.pc >> 8),
+        regs.a, regs.x, regs.y, regs.sp, regs.status,
+    };
+
+    uint64_t hash = fnv1a(bus.ppu.framebuffer, sizeof(bus.ppu.framebuffer));
+    hash = fnv1a(bus.ram, 0x0800, hash);
+    return fnv1a(reg_bytes, sizeof(reg_bytes), hash);
+}
+
+// Steps `count` independent consoles concurrently, one per thread, and checks
+// that they all end up in the same state. Any shared mutable state in the core
+// shows up here as a mismatch (or a crash).
+static int check_threads(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames, int count)
+{
+    std::vector<uint64_t> hashes(count, 0);
+    std::vector<std::exception_ptr> errors(count);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < count; ++i) {
+        threads.emplace_back([&, i]() {
+            try {
+                Bus bus(rom, options);
+                bus.cpu.reset();
+                for (long frame = 0; frame < frames; ++frame) {
+                    bus.run_frame();
+                }
+                hashes[i] = console_hash(bus);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < count; ++i) {
+        std::printf("console %d: %016llx\n", i, static_cast<unsigned long long>(hashes[i]));
+        if (hashes[i] != hashes[0]) {
+            ++mismatches;
+        }
+    }
+
+    if (mismatches) {
+        std::printf("FAIL: %d of %d consoles diverged\n", mismatches, count);
+        return 1;
+    }
+
+    std::printf("OK: %d consoles bit-identical after %ld frames\n", count, frames);
+    return 0;
+}
+
+// Steps `count` consoles through a VecEnv, two frames and a different action
+// per console at a time, and checks the framebuffers, RAM and done flags it
+// returns against plain consoles run_frame()d with the same input. Every 16th
+// step one console is reset and must carry on like a freshly built one.
+static int check_vec_env(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames, size_t count)
+{
+    const int frames_per_step = 2;
+    const uint16_t done_addr = 0x0000;
+
+    VecEnv env(rom, count, 0, options);
+    env.set_done_condition(done_addr, 0x01, 0x01);
+
+    std::vector<std::unique_ptr<Bus>> plain;
+    for (size_t i = 0; i < count; ++i) {
+        plain.emplace_back(new Bus(rom, options));
+        plain.back()->cpu.reset();
+    }
+
+    std::vector<uint8_t> actions(count);
+    std::vector<uint32_t> framebuffers(count * VecEnv::FRAMEBUFFER_PIXELS);
+    std::vector<uint8_t> ram(count * VecEnv::RAM_SIZE);
+    std::vector<uint8_t> done(count);
+
+    long steps = frames / frames_per_step;
+    long resets = 0;
+    for (long step = 0; step < steps; ++step) {
+        if (step % 16 == 15) {
+            size_t index = static_cast<size_t>(step / 16) % count;
+            env.reset(index);
+            plain[index].reset(new Bus(rom, options));
+            plain[index]->cpu.reset();
+            ++resets;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            actions[i] = static_cast<uint8_t>(((step * 37) >> 3) + i * 29);
+        }
+        env.step(actions.data(), frames_per_step, framebuffers.data(), ram.data(), done.data());
+
+        for (size_t i = 0; i < count; ++i) {
+            Bus &bus = *plain[i];
+            for (int bit = 0; bit < 8; ++bit) {
+                auto button = static_cast<Bus::ControllerButton>(1 << bit);
+                bus.set_controller_button(0, button, (actions[i] & button) != 0);
+            }
+            for (int frame = 0; frame < frames_per_step; ++frame) {
+                bus.run_frame();
+            }
+
+            uint8_t expected_done = (bus.ram[done_addr] & 0x01) == 0x01 ? 1 : 0;
+            if (std::memcmp(&framebuffers[i * VecEnv::FRAMEBUFFER_PIXELS], bus.ppu.framebuffer, sizeof(bus.ppu.framebuffer)) != 0 ||
+                std::memcmp(&ram[i * VecEnv::RAM_SIZE], bus.ram, VecEnv::RAM_SIZE) != 0 ||
+                done[i] != expected_done) {
+                std::printf("FAIL: console %zu diverged in step %ld\n", i, step);
+                return 1;
+            }
+        }
+    }
+
+    std::printf("OK: %zu consoles match plain consoles for %ld steps of %d frames (%ld resets)\n",
+                count, steps, frames_per_step, resets);
+    return 0;
+}
+
+// Runs one console for `frames` frames, cloning it halfway. The original and
+// the clone must both finish in the same state as a reference console that ran
+// straight through. Also reports how long a clone takes.
+static int check_clone(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    const int clone_iterations = 1000;
+
+    Bus reference(rom, options);
+    reference.cpu.reset();
+    for (long frame = 0; frame < frames; ++frame) {
+        reference.run_frame();
+    }
+
+    Bus original(rom, options);
+    original.cpu.reset();
+    for (long frame = 0; frame < frames / 2; ++frame) {
+        original.run_frame();
+    }
+
+    std::unique_ptr<Bus> copy = original.clone();
+    for (long frame = frames / 2; frame < frames; ++frame) {
+        original.run_frame();
+        copy->run_frame();
+    }
+
+    uint64_t expected = console_hash(reference);
+    uint64_t original_hash = console_hash(original);
+    uint64_t copy_hash = console_hash(*copy);
+    std::printf("reference: %016llx\n", static_cast<unsigned long long>(expected));
+    std::printf("original:  %016llx\n", static_cast<unsigned long long>(original_hash));
+    std::printf("clone:     %016llx\n", static_cast<unsigned long long>(copy_hash));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < clone_iterations; ++i) {
+        copy = original.clone(false);
+    }
+    double clone_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / clone_iterations;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < clone_iterations; ++i) {
+        copy->copy_state(original, false);
+    }
+    double copy_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / clone_iterations;
+
+    std::printf("clone:      %.2f us (copy_state into an existing console: %.2f us)\n", clone_us, copy_us);
+
+    if (original_hash != expected || copy_hash != expected) {
+        std::printf("FAIL: cloned console diverged\n");
+        return 1;
+    }
+    std::printf("OK: clone bit-identical after %ld frames\n", frames);
+    return 0;
+}
+
+// Runs the ROM twice, once drawing every frame and once drawing only the last,
+// and checks the two consoles end up identical (including the last frame).
+static int check_render_skip(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    Bus full(rom, options);
+    Bus skipped(rom, options);
+    full.cpu.reset();
+    skipped.cpu.reset();
+
+    auto start = std::chrono::steady_clock::now();
+    for (long frame = 0; frame < frames; ++frame) {
+        full.run_frame();
+    }
+    double full_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (long frame = 0; frame < frames; ++frame) {
+        skipped.run_frame(frame == frames - 1);
+    }
+    double skipped_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    PPUSaveState full_ppu = full.ppu.save_state();
+    PPUSaveState skipped_ppu = skipped.ppu.save_state();
+    bool same = console_hash(full) == console_hash(skipped) &&
+                fnv1a(&full_ppu, sizeof(full_ppu)) == fnv1a(&skipped_ppu, sizeof(skipped_ppu));
+
+    std::printf("drawn:   %.3f s\n", full_seconds);
+    std::printf("skipped: %.3f s (%.2fx)\n", skipped_seconds, skipped_seconds > 0.0 ? full_seconds / skipped_seconds : 0.0);
+    if (!same) {
+        std::printf("FAIL: skipping video output changed the emulated state\n");
+        return 1;
+    }
+    std::printf("OK: identical after %ld frames\n", frames);
+    return 0;
+}
+
+// Runs the ROM on two consoles built with a_options and b_options, giving both
+// the same input, and compares them after every frame. run_b advances the
+// second console by a frame. Reports where they diverged, if they did, and
+// how long each console took.
+struct Comparison {
+    std::unique_ptr<Bus> a;
+    std::unique_ptr<Bus> b;
+    double a_seconds = 0.0;
+    double b_seconds = 0.0;
+    bool same = true;
+};
+
+static void run_frame(Bus &bus)
+{
+    bus.run_frame();
+}
+
+static Comparison compare_consoles(std::shared_ptr<const RomImage> rom, const BusOptions &a_options, const BusOptions &b_options,
+                                   long frames, const char *label, void (*run_b)(Bus &) = run_frame)
+{
+    Comparison result;
+    result.a.reset(new Bus(rom, a_options));
+    result.b.reset(new Bus(rom, b_options));
+    Bus &a = *result.a;
+    Bus &b = *result.b;
+    a.cpu.reset();
+    b.cpu.reset();
+
+    for (long frame = 0; frame < frames; ++frame) {
+        uint8_t buttons = static_cast<uint8_t>((frame * 37) >> 3);
+        a.set_controller_state(0, buttons);
+        b.set_controller_state(0, buttons);
+
+        auto start = std::chrono::steady_clock::now();
+        a.run_frame();
+        auto middle = std::chrono::steady_clock::now();
+        run_b(b);
+        auto end = std::chrono::steady_clock::now();
+        result.a_seconds += std::chrono::duration<double>(middle - start).count();
+        result.b_seconds += std::chrono::duration<double>(end - middle).count();
+
+        PPUSaveState a_ppu = a.ppu.save_state();
+        PPUSaveState b_ppu = b.ppu.save_state();
+        if (console_hash(a) != console_hash(b) ||
+            a.cpu.getCycleCount() != b.cpu.getCycleCount() ||
+            fnv1a(&a_ppu, sizeof(a_ppu)) != fnv1a(&b_ppu, sizeof(b_ppu))) {
+            std::printf("FAIL: %s diverged in frame %ld\n", label, frame);
+            result.same = false;
+            break;
+        }
+    }
+    return result;
+}
+
+// Clocks a console dot by dot until the PPU completes a frame.
+static void clock_frame(Bus &bus)
+{
+    while (!bus.ppu.frame_complete) {
+        bus.clock();
+    }
+    bus.ppu.frame_complete = false;
+}
+
+// Compares a console run through run_frame() (instruction stepping, PPU and
+// APU only caught up on demand) against one clocked dot by dot.
+static int check_stepping(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    if (!compare_consoles(rom, options, options, frames, "instruction stepping", clock_frame).same) {
+        return 1;
+    }
+    std::printf("OK: identical to dot-by-dot clocking for %ld frames\n", frames);
+    return 0;
+}
+
+// Compares a console executing PRG ROM code from the CPU decode cache against
+// one fetching every instruction through the bus.
+static int check_decode_cache(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    BusOptions cached_options = options;
+    BusOptions fetched_options = options;
+    cached_options.decode_cache = true;
+    fetched_options.decode_cache = false;
+    Comparison run = compare_consoles(rom, cached_options, fetched_options, frames, "decode cache");
+    if (!run.same) {
+        return 1;
+    }
+
+    std::printf("decode cache: %.3f s\n", run.a_seconds);
+    std::printf("bus fetch:    %.3f s (%.2fx)\n", run.b_seconds, run.a_seconds > 0.0 ? run.b_seconds / run.a_seconds : 0.0);
+    std::printf("OK: identical to fetching through the bus for %ld frames\n", frames);
+    return 0;
+}
+
+// Compares a console running hot PRG ROM code as compiled x86-64 code against
+// one interpreting all of it.
+static int check_jit(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    BusOptions compiled_options = options;
+    BusOptions interpreted_options = options;
+    compiled_options.jit = true;
+    interpreted_options.jit = false;
+    Comparison run = compare_consoles(rom, compiled_options, interpreted_options, frames, "JIT");
+    if (!run.same) {
+        return 1;
+    }
+
+    std::printf("jit:         %.3f s\n", run.a_seconds);
+    std::printf("interpreter: %.3f s (%.2fx)\n", run.b_seconds, run.a_seconds > 0.0 ? run.b_seconds / run.a_seconds : 0.0);
+    std::printf("OK: identical to the interpreter for %ld frames\n", frames);
+    return 0;
+}
+
+// Compares a console running PRG ROM code from an AOT module against one
+// interpreting all of it.
+static int check_aot(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    if (!options.aot) {
+        std::fprintf(stderr, "error: --check-aot needs --aot\n");
+        return 2;
+    }
+    BusOptions interpreted_options = options;
+    interpreted_options.aot.reset();
+    interpreted_options.jit = false;
+    Comparison run = compare_consoles(rom, options, interpreted_options, frames, "AOT module");
+    if (!run.same) {
+        return 1;
+    }
+
+    std::printf("aot:         %.3f s (%zu blocks)\n", run.a_seconds, options.aot->block_count());
+    std::printf("interpreter: %.3f s (%.2fx)\n", run.b_seconds, run.a_seconds > 0.0 ? run.b_seconds / run.a_seconds : 0.0);
+    std::printf("OK: identical to the interpreter for %ld frames\n", frames);
+    return 0;
+}
+
+// Compares a console skipping idle loop iterations against one running them
+// all, and reports how much of the run was skipped.
+static int check_idle_skip(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    BusOptions skipping_options = options;
+    BusOptions running_options = options;
+    skipping_options.idle_skip = true;
+    running_options.idle_skip = false;
+    Comparison run = compare_consoles(rom, skipping_options, running_options, frames, "idle loop skipping");
+    if (!run.same) {
+        return 1;
+    }
+
+    double total_dots = static_cast<double>(run.b->cpu.getCycleCount()) * 3.0;
+    std::printf("idle skip: %.3f s (%.1f%% of dots skipped)\n", run.a_seconds,
+                total_dots > 0.0 ? 100.0 * static_cast<double>(run.a->get_idle_dots()) / total_dots : 0.0);
+    std::printf("no skip:   %.3f s (%.2fx)\n", run.b_seconds, run.a_seconds > 0.0 ? run.b_seconds / run.a_seconds : 0.0);
+    std::printf("OK: identical to running every iteration for %ld frames\n", frames);
+    return 0;
+}
+
+// Compares a console accessing cartridge memory through the bus and PPU page
+// tables against one going through the mapper interface.
+static int check_page_tables(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    BusOptions tabled_options = options;
+    BusOptions mapped_options = options;
+    tabled_options.page_tables = true;
+    mapped_options.page_tables = false;
+    Comparison run = compare_consoles(rom, tabled_options, mapped_options, frames, "page tables");
+    if (!run.same) {
+        return 1;
+    }
+
+    std::printf("page tables: %.3f s\n", run.a_seconds);
+    std::printf("mapper:      %.3f s (%.2fx)\n", run.b_seconds, run.a_seconds > 0.0 ? run.b_seconds / run.a_seconds : 0.0);
+    std::printf("OK: identical to going through the mapper for %ld frames\n", frames);
+    return 0;
+}
+
+#ifndef _WIN32
+// Warms a console up for `frames` frames, forks `workers` processes from it and
+// runs `scripts` random 60-frame input scripts across them. The first script
+// of each worker is replayed in-process to check the worker result.
+static int run_fork(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames, size_t workers, long scripts)
+{
+    const uint32_t script_frames = 60;
+
+    Bus parent(rom, options);
+    parent.cpu.reset();
+    for (long frame = 0; frame < frames; ++frame) {
+        parent.run_frame();
+    }
+
+    std::vector<std::vector<uint8_t>> inputs(scripts, std::vector<uint8_t>(script_frames));
+    uint32_t seed = 0x12345678;
+    for (std::vector<uint8_t> &script : inputs) {
+        for (uint8_t &input : script) {
+            seed = seed * 1664525u + 1013904223u;
+            input = static_cast<uint8_t>(seed >> 24);
+        }
+    }
+
+    ForkServer server(parent, workers);
+    std::vector<uint64_t> hashes(scripts);
+
+    auto start = std::chrono::steady_clock::now();
+    for (long script = 0; script < scripts; ++script) {
+        size_t worker = script % workers;
+        if (script >= static_cast<long>(workers)) {
+            hashes[script - workers] = server.wait(worker).frame_hash;
+        }
+        server.submit(worker, inputs[script].data(), script_frames);
+    }
+    for (long script = scripts > static_cast<long>(workers) ? scripts - workers : 0; script < scripts; ++script) {
+        hashes[script] = server.wait(script % workers).frame_hash;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int mismatches = 0;
+    for (long script = 0; script < scripts && script < static_cast<long>(workers); ++script) {
+        std::unique_ptr<Bus> local = parent.clone(false);
+        for (uint8_t input : inputs[script]) {
+            local->set_controller_state(0, input);
+            local->run_frame();
+        }
+        if (fnv1a(local->ppu.framebuffer, sizeof(local->ppu.framebuffer)) != hashes[script]) {
+            ++mismatches;
+        }
+    }
+
+    std::printf("workers: %zu, scripts: %ld x %u frames\n", workers, scripts, script_frames);
+    std::printf("time:    %.3f s (%.1f scripts/s)\n", seconds, seconds > 0.0 ? scripts / seconds : 0.0);
+    if (mismatches) {
+        std::printf("FAIL: %d worker results differ from an in-process replay\n", mismatches);
+        return 1;
+    }
+    std::printf("OK: worker results match in-process replay\n");
+    return 0;
+}
+
+// Forks two workers, kills the first and checks that submitting to it throws
+// while the second keeps serving scripts.
+static int check_fork_crash(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames)
+{
+    Bus parent(rom, options);
+    parent.cpu.reset();
+    for (long frame = 0; frame < frames; ++frame) {
+        parent.run_frame();
+    }
+
+    ForkServer server(parent, 2);
+    std::vector<uint8_t> inputs(60, 0);
+
+    // Reap the worker so its end of the request pipe is closed for certain.
+    pid_t pid = server.pid(0);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    bool threw = false;
+    try {
+        server.submit(0, inputs.data(), inputs.size());
+        server.wait(0);
+    } catch (const std::exception &e) {
+        std::printf("dead worker: %s\n", e.what());
+        threw = true;
+    }
+    if (!threw) {
+        std::printf("FAIL: a killed fork worker did not raise an error\n");
+        return 1;
+    }
+
+    server.submit(1, inputs.data(), inputs.size());
+    if (server.wait(1).frames != inputs.size()) {
+        std::printf("FAIL: the surviving fork worker returned a wrong result\n");
+        return 1;
+    }
+    std::printf("OK: killed fork worker raised an error, the other kept running\n");
+    return 0;
+}
+#endif
+
+static int run_batch(std::shared_ptr<const RomImage> rom, const BusOptions &options, long frames, size_t instances, unsigned threads)
+{
+    BatchRunner runner(rom, instances, threads, options);
+    for (long frame = 0; frame < frames; ++frame) {
+        runner.run_frame();
+    }
+
+    BatchStats stats = runner.stats();
+    std::printf("consoles: %zu on %u threads\n", runner.size(), runner.thread_count());
+    std::printf("frames:   %llu\n", static_cast<unsigned long long>(stats.frames));
+    std::printf("time:     %.3f s\n", stats.wall_seconds);
+    std::printf("fps:      %.1f total (%.2fx real time per console)\n",
+                stats.frames_per_second, stats.frames_per_second / NES_FRAME_RATE / runner.size());
+    for (size_t worker = 0; worker < stats.worker_frames_per_second.size(); ++worker) {
+        std::printf("  worker %zu: %.1f fps\n", worker, stats.worker_frames_per_second[worker]);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *rom_path = nullptr;
+    const char *dump_path = nullptr;
+    long frames = 600;
+    int check_thread_count = 0;
+    long check_vec_env_count = 0;
+    bool check_clone_mode = false;
+    bool check_render_skip_mode = false;
+    bool check_stepping_mode = false;
+    bool check_decode_cache_mode = false;
+    bool check_jit_mode = false;
+    bool check_aot_mode = false;
+    bool check_idle_skip_mode = false;
+    bool check_page_tables_mode = false;
+    const char *aot_path = nullptr;
+    long render_every = 1;
+    long fork_workers = 0;
+    long fork_scripts = 64;
+    bool check_fork_crash_mode = false;
+    long batch = 0;
+    long threads = 0;
+    bool map_rom = false;
+    BusOptions options;
+    options.audio = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (std::strcmp(arg, "--rom") == 0 && has_value) {
+            rom_path = argv[++i];
+        } else if (std::strcmp(arg, "--audio") == 0) {
+            options.audio = true;
+        } else if (std::strcmp(arg, "--mmap") == 0) {
+            map_rom = true;
+        } else if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--dump-framebuffer") == 0 && has_value) {
+            dump_path = argv[++i];
+        } else if (std::strcmp(arg, "--batch") == 0 && has_value) {
+            batch = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            threads = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--check-vec-env") == 0 && has_value) {
+            check_vec_env_count = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--fork") == 0 && has_value) {
+            fork_workers = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--scripts") == 0 && has_value) {
+            fork_scripts = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--check-fork-crash") == 0) {
+            check_fork_crash_mode = true;
+        } else if (std::strcmp(arg, "--render-every") == 0 && has_value) {
+            render_every = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--no-decode-cache") == 0) {
+            options.decode_cache = false;
+        } else if (std::strcmp(arg, "--no-idle-skip") == 0) {
+            options.idle_skip = false;
+        } else if (std::strcmp(arg, "--no-page-tables") == 0) {
+            options.page_tables = false;
+        } else if (std::strcmp(arg, "--jit") == 0) {
+            options.jit = true;
+        } else if (std::strcmp(arg, "--check-jit") == 0) {
+            check_jit_mode = true;
+        } else if (std::strcmp(arg, "--aot") == 0 && has_value) {
+            aot_path = argv[++i];
+        } else if (std::strcmp(arg, "--check-aot") == 0) {
+            check_aot_mode = true;
+        } else if (std::strcmp(arg, "--check-decode-cache") == 0) {
+            check_decode_cache_mode = true;
+        } else if (std::strcmp(arg, "--check-idle-skip") == 0) {
+            check_idle_skip_mode = true;
+        } else if (std::strcmp(arg, "--check-page-tables") == 0) {
+            check_page_tables_mode = true;
+        } else if (std::strcmp(arg, "--check-stepping") == 0) {
+            check_stepping_mode = true;
+        } else if (std::strcmp(arg, "--check-render-skip") == 0) {
+            check_render_skip_mode = true;
+        } else if (std::strcmp(arg, "--check-clone") == 0) {
+            check_clone_mode = true;
+        } else if (std::strcmp(arg, "--check-threads") == 0 && has_value) {
+            check_thread_count = std::atoi(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!rom_path || frames < 0 || batch < 0 || threads < 0 || check_vec_env_count < 0
+        || fork_workers < 0 || fork_scripts < 0 || render_every < 1) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    try {
+        std::shared_ptr<const RomImage> rom = RomImage::load(rom_path, map_rom);
+        if (aot_path) {
+            options.aot = AotModule::load(aot_path);
+        }
+
+        if (check_thread_count > 0) {
+            return check_threads(rom, options, frames, check_thread_count);
+        }
+        if (check_vec_env_count > 0) {
+            return check_vec_env(rom, options, frames, check_vec_env_count);
+        }
+        if (fork_workers > 0) {
+#ifndef _WIN32
+            return run_fork(rom, options, frames, fork_workers, fork_scripts);
+#else
+            std::fprintf(stderr, "error: --fork needs a POSIX system\n");
+            return 2;
+#endif
+        }
+        if (check_fork_crash_mode) {
+#ifndef _WIN32
+            return check_fork_crash(rom, options, frames);
+#else
+            std::fprintf(stderr, "error: --check-fork-crash needs a POSIX system\n");
+            return 2;
+#endif
+        }
+        if (check_stepping_mode) {
+            return check_stepping(rom, options, frames);
+        }
+        if (check_decode_cache_mode) {
+            return check_decode_cache(rom, options, frames);
+        }
+        if (check_jit_mode) {
+            return check_jit(rom, options, frames);
+        }
+        if (check_aot_mode) {
+            return check_aot(rom, options, frames);
+        }
+        if (check_idle_skip_mode) {
+            return check_idle_skip(rom, options, frames);
+        }
+        if (check_page_tables_mode) {
+            return check_page_tables(rom, options, frames);
+        }
+        if (check_render_skip_mode) {
+            return check_render_skip(rom, options, frames);
+        }
+        if (check_clone_mode) {
+            return check_clone(rom, options, frames);
+        }
+        if (batch > 0) {
+            return run_batch(rom, options, frames, batch, threads);
+        }
+
+        Bus bus(rom, options);
+        bus.cpu.reset();
+
+        auto start = std::chrono::steady_clock::now();
+        for (long frame = 0; frame < frames; ++frame) {
+            bus.run_frame(frame % render_every == 0 || frame == frames - 1);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double fps = seconds > 0.0 ? frames / seconds : 0.0;
+        std::printf("frames: %ld\n", frames);
+        std::printf("time:   %.3f s\n", seconds);
+        std::printf("fps:    %.1f (%.2fx real time)\n", fps, fps / NES_FRAME_RATE);
+
+        if (dump_path && !dump_framebuffer(bus, dump_path)) {
+            std::fprintf(stderr, "Failed to write framebuffer to %s\n", dump_path);
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -6,8 +6,10 @@
 
 #include "imgui_memory_editor.h"
 #include "emu/bus/bus.h"
+#include "emu/APU/AudioPlayer.h"
 #include <cstdio>
 #include <filesystem>
+#include <memory>
 #include <string>
 
 int main(int argc, char *argv[])
@@ -17,7 +19,10 @@ int main(int argc, char *argv[])
     SDL_Event event;
     SDL_Texture* texture = nullptr;
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+    // nestastic <rom> [--no-audio]
+    bool audio = !(argc > 2 && std::string(argv[2]) == "--no-audio");
+
+    if (SDL_Init(SDL_INIT_VIDEO | (audio ? SDL_INIT_AUDIO : 0)) < 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
         return 3;
     }
@@ -47,9 +52,30 @@ int main(int argc, char *argv[])
         rom_label = std::filesystem::path(rom_arg).filename().string();
     }
 
-    Bus bus(rom_arg);
+    BusOptions bus_options;
+    bus_options.audio = audio;
+    Bus bus(rom_arg, bus_options);
     bus.cpu.reset();
 
+    // The emulation core never opens an audio device; the front-end owns the
+    // player and hands its queue to the APU. 44100 matches the APU's sample rate.
+    std::unique_ptr<AudioPlayer> audio_player;
+    if (audio) {
+        audio_player.reset(new AudioPlayer(44100));
+        audio_player->start();
+
+        // Prefill the audio queue with a small burst of silence so the audio callback
+        // has some headroom during startup and short scheduling hiccups. This reduces
+        // the likelihood of initial crackle caused by immediate underflow.
+        // Push ~200ms of silence as a warm-up buffer.
+        const int prefill_ms = 200;
+        const int prefill_samples = (audio_player->output_sample_rate * prefill_ms) / 1000;
+        for (int i = 0; i < prefill_samples; ++i) {
+            audio_player->audio_queue.push(0.0f);
+        }
+        bus.apu->set_audio_queue(&audio_player->audio_queue);
+    }
+
     auto handle_key = [&bus](SDL_Keycode key, bool pressed) {
         switch (key) {
             case SDLK_x:
@@ -130,10 +156,7 @@ int main(int argc, char *argv[])
 
         bool frame_rendered = false;
         while (running && accumulator >= target_frame_time) {
-            while (!bus.ppu.frame_complete) {
-                bus.clock();
-            }
-            bus.ppu.frame_complete = false;
+            bus.run_frame();
 
             SDL_UpdateTexture(texture, nullptr, bus.ppu.framebuffer, 256 * sizeof(uint32_t));
 
@@ -159,8 +182,7 @@ int main(int argc, char *argv[])
         {
             if (ImGui::BeginMenu("Emulation")) {
                 if (ImGui::MenuItem("Reset")) {
-                    bus.cpu.reset();
-                    bus.ppu.reset();
+                    bus.reset();
                 }
                 ImGui::MenuItem("Debug", nullptr, &debug_mode);
                 ImGui::EndMenu();